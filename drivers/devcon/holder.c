@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2015 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * devcon is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include "holder.h"
+
+/*
+ * State Holder
+ * This is a separate, trivial module that keeps the serialized state of devcon
+ * while devcon itself is reloaded. It never interprets the buffer. It has to
+ * be loaded before devcon is unloaded, and must not be unloaded in between,
+ * otherwise the state is dropped.
+ */
+
+static DEFINE_MUTEX(devcon_holder_lock);
+static void *devcon_holder_data;
+static size_t devcon_holder_size;
+
+/**
+ * devcon_holder_store() - Store a buffer
+ * @data: vmalloc'ed buffer to store, or NULL
+ * @size: size of @data in bytes
+ *
+ * This takes ownership of @data and keeps it until devcon_holder_take() is
+ * called. Any previously stored buffer is released.
+ */
+void devcon_holder_store(void *data, size_t size)
+{
+	void *old;
+
+	mutex_lock(&devcon_holder_lock);
+	old = devcon_holder_data;
+	devcon_holder_data = data;
+	devcon_holder_size = data ? size : 0;
+	mutex_unlock(&devcon_holder_lock);
+
+	vfree(old);
+}
+EXPORT_SYMBOL_GPL(devcon_holder_store);
+
+/**
+ * devcon_holder_take() - Retrieve the stored buffer
+ * @size: place to store the size of the buffer
+ *
+ * This returns the buffer stored via devcon_holder_store() and passes its
+ * ownership to the caller, who must release it via vfree().
+ *
+ * Returns: The stored buffer, or NULL if there is none.
+ */
+void *devcon_holder_take(size_t *size)
+{
+	void *data;
+
+	mutex_lock(&devcon_holder_lock);
+	data = devcon_holder_data;
+	*size = devcon_holder_size;
+	devcon_holder_data = NULL;
+	devcon_holder_size = 0;
+	mutex_unlock(&devcon_holder_lock);
+
+	return data;
+}
+EXPORT_SYMBOL_GPL(devcon_holder_take);
+
+static int __init devcon_holder_init(void)
+{
+	return 0;
+}
+
+static void __exit devcon_holder_exit(void)
+{
+	if (devcon_holder_data)
+		pr_info("dropping preserved state\n");
+
+	vfree(devcon_holder_data);
+}
+
+module_init(devcon_holder_init);
+module_exit(devcon_holder_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Developer Console State Holder");
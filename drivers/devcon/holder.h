@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2015 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * devcon is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#ifndef __DEVCON_HOLDER_H
+#define __DEVCON_HOLDER_H
+
+#include <linux/kernel.h>
+
+/*
+ * State Holder
+ * The devcon_holder module keeps a single buffer across reloads of devcon.
+ * devcon does not depend on it. It looks up these symbols via symbol_get()
+ * and only preserves its state if the holder is loaded.
+ */
+
+void devcon_holder_store(void *data, size_t size);
+void *devcon_holder_take(size_t *size);
+
+#endif /* __DEVCON_HOLDER_H */
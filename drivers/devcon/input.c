@@ -8,53 +8,80 @@
  */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/debugfs.h>
 #include <linux/input.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/uaccess.h>
 #include "input.h"
 #include "keyboard.h"
+#include "seat.h"
 
 /*
  * Input Handling
+ * Each input device is bound to exactly one seat. The device carries a
+ * pointer to its seat, and each seat has its own list of input handlers.
+ * Hence, events are only ever delivered to the handlers of the seat a device
+ * is bound to, and the routing cost does not depend on the number of seats.
+ * Devices are opened as soon as they are connected, regardless of whether
+ * their seat has any handlers. Otherwise, key presses on idle seats would go
+ * unnoticed, and the hotkey could never be invoked on them.
  */
 
+struct devcon_input_seat {
+	unsigned int index;
+	struct list_head handlers;
+};
+
 struct devcon_input {
 	struct list_head list;
 	struct input_handle handle;
+	struct devcon_input_seat *seat;
 	bool open : 1;
 };
 
 static struct input_handler devcon_input_handler;
-static size_t devcon_input_users;
+static struct devcon_input_seat devcon_input_seats[DEVCON_SEAT_MAX];
+static unsigned int devcon_input_active_seat;
 static DEFINE_MUTEX(devcon_input_lock);
 static LIST_HEAD(devcon_input_handles);
 static DEFINE_SPINLOCK(devcon_input_spinlock);
-static LIST_HEAD(devcon_input_handlers);
 
 static bool devcon_iops_filter(struct input_handle *handle,
 			       unsigned int type,
 			       unsigned int code,
 			       int value)
 {
+	struct devcon_input *input = container_of(handle, struct devcon_input,
+						  handle);
 	struct devcon_input_handler *h;
 	struct devcon_keyboard_event event;
+	struct devcon_input_seat *seat;
 	bool suppress = false;
 
 	switch (type) {
 	case EV_KEY:
-		if (devcon_keyboard_handle(handle->dev, &event, code, value)) {
-			spin_lock(&devcon_input_spinlock);
-			list_for_each_entry(h, &devcon_input_handlers, list) {
+		spin_lock(&devcon_input_spinlock);
+		seat = input->seat;
+
+		/* releases and autorepeat do not change the active seat */
+		if (value == 1)
+			ACCESS_ONCE(devcon_input_active_seat) = seat->index;
+
+		if (!list_empty(&seat->handlers) &&
+		    devcon_keyboard_handle(handle->dev, &event, code, value)) {
+			list_for_each_entry(h, &seat->handlers, list) {
 				if (h->event(h, &event)) {
 					suppress = true;
 					break;
 				}
 			}
-			spin_unlock(&devcon_input_spinlock);
 		}
+		spin_unlock(&devcon_input_spinlock);
 		break;
 	}
 
@@ -89,6 +116,7 @@ static int devcon_iops_connect(struct input_handler *handler,
 	input->handle.dev = input_get_device(device);
 	input->handle.name = "devcon";
 	input->handle.handler = handler;
+	input->seat = &devcon_input_seats[0];
 
 	ret = input_register_handle(&input->handle);
 	if (ret < 0)
@@ -96,11 +124,9 @@ static int devcon_iops_connect(struct input_handler *handler,
 
 	mutex_lock(&devcon_input_lock);
 	list_add_tail(&input->list, &devcon_input_handles);
-	if (devcon_input_users > 0) {
-		ret = input_open_device(&input->handle);
-		if (ret >= 0)
-			input->open = true;
-	}
+	ret = input_open_device(&input->handle);
+	if (ret >= 0)
+		input->open = true;
 	mutex_unlock(&devcon_input_lock);
 
 	return 0;
@@ -145,29 +171,12 @@ void devcon_input_init_handler(struct devcon_input_handler *handler)
 {
 	INIT_LIST_HEAD(&handler->list);
 	handler->event = NULL;
-}
-
-static void devcon_input_open_close(struct devcon_input *input, int diff)
-{
-	int ret;
-
-	if (diff > 0) {
-		if (!input->open) {
-			ret = input_open_device(&input->handle);
-			if (ret >= 0)
-				input->open = true;
-		}
-	} else if (diff < 0) {
-		if (input->open) {
-			input_close_device(&input->handle);
-			input->open = false;
-		}
-	}
+	handler->seat = 0;
 }
 
 void devcon_input_open(struct devcon_input_handler *h)
 {
-	struct devcon_input *input;
+	struct devcon_input_seat *seat;
 	unsigned long flags;
 
 	if (WARN_ON(!devcon_input_handler.name))
@@ -176,46 +185,144 @@ void devcon_input_open(struct devcon_input_handler *h)
 		return;
 	if (WARN_ON(!h->event))
 		return;
+	if (WARN_ON(h->seat >= DEVCON_SEAT_MAX))
+		return;
+
+	seat = &devcon_input_seats[h->seat];
 
 	spin_lock_irqsave(&devcon_input_spinlock, flags);
-	list_add_tail(&h->list, &devcon_input_handlers);
+	list_add_tail(&h->list, &seat->handlers);
 	spin_unlock_irqrestore(&devcon_input_spinlock, flags);
-
-	mutex_lock(&devcon_input_lock);
-	if (!devcon_input_users++)
-		list_for_each_entry(input, &devcon_input_handles, list)
-			devcon_input_open_close(input, 1);
-	mutex_unlock(&devcon_input_lock);
 }
 
 void devcon_input_close(struct devcon_input_handler *h)
 {
-	struct devcon_input *input;
 	unsigned long flags;
 
 	if (WARN_ON(!devcon_input_handler.name))
 		return;
-	if (WARN_ON(!devcon_input_users))
+	if (WARN_ON(list_empty(&h->list)))
 		return;
 
 	spin_lock_irqsave(&devcon_input_spinlock, flags);
 	list_del_init(&h->list);
 	spin_unlock_irqrestore(&devcon_input_spinlock, flags);
+}
+
+/**
+ * devcon_input_get_active_seat() - Return seat of last active keyboard
+ *
+ * This returns the index of the seat that the most recent key press was
+ * received on. It is used to decide which seat a global hotkey (like sysrq)
+ * applies to, as those are not bound to a specific device.
+ *
+ * This can be called from atomic context just fine.
+ */
+unsigned int devcon_input_get_active_seat(void)
+{
+	return ACCESS_ONCE(devcon_input_active_seat);
+}
+
+static int devcon_input_set_seat(const char *name, unsigned int index)
+{
+	struct devcon_input_seat *seat;
+	struct devcon_input *input;
+	unsigned long flags;
+	int ret = -ENODEV;
+
+	if (index >= DEVCON_SEAT_MAX)
+		return -EINVAL;
+
+	seat = &devcon_input_seats[index];
 
 	mutex_lock(&devcon_input_lock);
-	if (!--devcon_input_users)
-		list_for_each_entry(input, &devcon_input_handles, list)
-			devcon_input_open_close(input, -1);
+	list_for_each_entry(input, &devcon_input_handles, list) {
+		if (strcmp(dev_name(&input->handle.dev->dev), name))
+			continue;
+
+		spin_lock_irqsave(&devcon_input_spinlock, flags);
+		input->seat = seat;
+		spin_unlock_irqrestore(&devcon_input_spinlock, flags);
+
+		ret = 0;
+		break;
+	}
+	mutex_unlock(&devcon_input_lock);
+
+	return ret;
+}
+
+static int devcon_input_debugfs_show(struct seq_file *m, void *v)
+{
+	struct devcon_input *input;
+
+	mutex_lock(&devcon_input_lock);
+	list_for_each_entry(input, &devcon_input_handles, list)
+		seq_printf(m, "%s %u %s\n",
+			   dev_name(&input->handle.dev->dev),
+			   input->seat->index,
+			   input->handle.dev->name ? : "");
 	mutex_unlock(&devcon_input_lock);
+
+	return 0;
 }
 
-int devcon_input_init(void)
+static int devcon_input_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, devcon_input_debugfs_show, NULL);
+}
+
+/*
+ * Writing "<device> <seat>" to the debugfs file moves the input device with
+ * the given kernel name (eg., "input3") to the given seat.
+ */
+static ssize_t devcon_input_debugfs_write(struct file *file,
+					  const char __user *ubuf,
+					  size_t size,
+					  loff_t *off)
 {
+	char buf[64], name[32];
+	unsigned int index;
 	int ret;
 
+	if (size >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, size))
+		return -EFAULT;
+
+	buf[size] = 0;
+	if (sscanf(buf, "%31s %u", name, &index) != 2)
+		return -EINVAL;
+
+	ret = devcon_input_set_seat(name, index);
+	if (ret < 0)
+		return ret;
+
+	return size;
+}
+
+static const struct file_operations devcon_input_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= devcon_input_debugfs_open,
+	.read		= seq_read,
+	.write		= devcon_input_debugfs_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int devcon_input_init(struct dentry *debugfs)
+{
+	int ret, i;
+
 	if (WARN_ON(devcon_input_handler.name))
 		return -EINVAL;
 
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		devcon_input_seats[i].index = i;
+		INIT_LIST_HEAD(&devcon_input_seats[i].handlers);
+	}
+	devcon_input_active_seat = 0;
+
 	devcon_input_handler.name = "devcon";
 	devcon_input_handler.filter = devcon_iops_filter;
 	devcon_input_handler.match = devcon_iops_match;
@@ -228,6 +335,10 @@ int devcon_input_init(void)
 	if (ret < 0)
 		goto error;
 
+	if (debugfs)
+		debugfs_create_file("inputs", S_IRUSR | S_IWUSR, debugfs, NULL,
+				    &devcon_input_debugfs_fops);
+
 	return 0;
 
 error:
@@ -237,10 +348,13 @@ error:
 
 void devcon_input_destroy(void)
 {
+	int i;
+
 	if (!devcon_input_handler.name)
 		return;
 
-	WARN_ON(!list_empty(&devcon_input_handlers));
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		WARN_ON(!list_empty(&devcon_input_seats[i].handlers));
 
 	input_unregister_handler(&devcon_input_handler);
 	WARN_ON(!list_empty(&devcon_input_handles));
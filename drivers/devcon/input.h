@@ -13,7 +13,9 @@
 #include <linux/kernel.h>
 #include <linux/list.h>
 #include "keyboard.h"
+#include "seat.h"
 
+struct dentry;
 struct devcon_input_event;
 struct devcon_input_handler;
 
@@ -21,13 +23,15 @@ struct devcon_input_handler {
 	struct list_head list;
 	bool (*event) (struct devcon_input_handler *,
 		       const struct devcon_keyboard_event *);
+	unsigned int seat;
 };
 
-int devcon_input_init(void);
+int devcon_input_init(struct dentry *debugfs);
 void devcon_input_destroy(void);
 
 void devcon_input_init_handler(struct devcon_input_handler *handler);
 void devcon_input_open(struct devcon_input_handler *handler);
 void devcon_input_close(struct devcon_input_handler *handler);
+unsigned int devcon_input_get_active_seat(void);
 
 #endif /* __DEVCON_INPUT_H */
@@ -8,14 +8,20 @@
  */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/debugfs.h>
+#include <linux/err.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/sysrq.h>
 #include "input.h"
+#include "page.h"
+#include "parser.h"
 #include "terminal.h"
 #include "tty.h"
 #include "video.h"
 
+static struct dentry *devcon_debugfs;
+
 static void devcon_sysrq_handler(int key)
 {
 	devcon_terminal_hotkey();
@@ -32,25 +38,35 @@ static int __init devcon_init(void)
 {
 	int ret;
 
+	devcon_wcwidth_init();
+
+	ret = devcon_parser_selftest();
+	if (ret < 0)
+		return ret;
+
+	devcon_debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (IS_ERR(devcon_debugfs))
+		devcon_debugfs = NULL;
+
 	ret = devcon_tty_init();
 	if (ret < 0) {
 		pr_err("cannot initialize TTY subsystem\n");
 		goto error;
 	}
 
-	ret = devcon_input_init();
+	ret = devcon_input_init(devcon_debugfs);
 	if (ret < 0) {
 		pr_err("cannot initialize input subsystem\n");
 		goto error;
 	}
 
-	ret = devcon_video_init();
+	ret = devcon_video_init(devcon_debugfs);
 	if (ret < 0) {
 		pr_err("cannot initialize video subsystem\n");
 		goto error;
 	}
 
-	ret = devcon_terminal_init();
+	ret = devcon_terminal_init(devcon_debugfs);
 	if (ret < 0) {
 		pr_err("cannot initialize terminal subsystem\n");
 		goto error;
@@ -66,6 +82,7 @@ static int __init devcon_init(void)
 	return 0;
 
 error:
+	debugfs_remove_recursive(devcon_debugfs);
 	devcon_terminal_destroy();
 	devcon_video_destroy();
 	devcon_input_destroy();
@@ -76,6 +93,8 @@ error:
 static void __exit devcon_exit(void)
 {
 	unregister_sysrq_key('g', &devcon_sysrq);
+	debugfs_remove_recursive(devcon_debugfs);
+	devcon_terminal_preserve();
 	devcon_terminal_destroy();
 	devcon_video_destroy();
 	devcon_input_destroy();
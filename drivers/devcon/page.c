@@ -8,9 +8,13 @@
  */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/jhash.h>
 #include <linux/kernel.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/timekeeping.h>
 #include "page.h"
+#include "parser.h"
 
 /*
  * Terminal Page/Line/Cell/Char Handling
@@ -30,6 +34,9 @@
  * While lines are dynamically allocated, cells are not. This would be a waste
  * of memory and causes heavy fragmentation. Furthermore, cells are moved much
  * less frequently than lines so the performance-penalty is pretty small.
+ * Each line only allocates its cells up to the right-most modified cell. All
+ * cells beyond are implied blanks, which share the attributes and age stored
+ * in the line. This way, memory scales with the content, not the width.
  * However, to support combining-characters, we have to initialize and cleanup
  * cells properly and cannot just release the underlying memory. Therefore,
  * cells are treated as proper objects despite being allocated in arrays.
@@ -168,7 +175,7 @@ static struct devcon_character *devcon_char_alloc(u8 n)
 {
 	struct devcon_character *c;
 
-	c = kmalloc(sizeof(*c) + sizeof(*c->codepoints) * (n + 1), GFP_KERNEL);
+	c = kmalloc(sizeof(*c) + sizeof(*c->codepoints) * (n + 1), DEVCON_GFP);
 	if (!c)
 		return NULL;
 
@@ -413,7 +420,7 @@ unsigned int devcon_char_lookup_width(struct devcon_char ch)
 	str = devcon_char_resolve(ch, &len, &b);
 
 	if (len > 0) {
-		ret = mk_wcwidth((int)str[0]);
+		ret = devcon_wcwidth(str[0]);
 		if (ret > 0)
 			max = ret;
 	}
@@ -421,7 +428,7 @@ unsigned int devcon_char_lookup_width(struct devcon_char ch)
 	return max;
 }
 
-static const u8 devcon_default_palette[18][3] = {
+static const u8 devcon_default_palette[DEVCON_PALETTE_N][3] = {
 	{   0,   0,   0 }, /* black */
 	{ 205,   0,   0 }, /* red */
 	{   0, 205,   0 }, /* green */
@@ -443,45 +450,156 @@ static const u8 devcon_default_palette[18][3] = {
 	{   0,   0,   0 }, /* background: black */
 };
 
+/* channel values of the 6x6x6 color cube of the 256-color palette */
+static const u8 devcon_c256_levels[] = {
+	0x00, 0x5f, 0x87,
+	0xaf, 0xd7, 0xff,
+};
+
+/* resolve entry @t of the 256-color palette; @palette is used for t < 16 */
+static void devcon_c256_to_rgb(u8 t, const u8 *palette,
+			       u32 *r, u32 *g, u32 *b)
+{
+	if (t < 16) {
+		*r = palette[t * 3 + 0];
+		*g = palette[t * 3 + 1];
+		*b = palette[t * 3 + 2];
+	} else if (t < 232) {
+		t -= 16;
+		*b = devcon_c256_levels[t % 6];
+		t /= 6;
+		*g = devcon_c256_levels[t % 6];
+		t /= 6;
+		*r = devcon_c256_levels[t % 6];
+	} else {
+		*r = *g = *b = (t - 232) * 10 + 8;
+	}
+}
+
+static unsigned int devcon_rgb_dist(int r1, int g1, int b1,
+				    int r2, int g2, int b2)
+{
+	return (r1 - r2) * (r1 - r2) +
+	       (g1 - g2) * (g1 - g2) +
+	       (b1 - b2) * (b1 - b2);
+}
+
+/* return the index of the closest of the 16 ANSI colors */
+static u8 devcon_rgb_to_ansi(u32 r, u32 g, u32 b)
+{
+	unsigned int i, best = 0, dist, best_dist = UINT_MAX;
+
+	for (i = 0; i < 16; ++i) {
+		dist = devcon_rgb_dist(r, g, b,
+				       devcon_default_palette[i][0],
+				       devcon_default_palette[i][1],
+				       devcon_default_palette[i][2]);
+		if (dist < best_dist) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+
+	return best;
+}
+
+#if DEVCON_COLOR_DEPTH == 256
+/* return the closest entry of the color cube or grayscale ramp */
+static u8 devcon_rgb_to_256(u8 r, u8 g, u8 b)
+{
+	unsigned int ri, gi, bi, avg, gray;
+
+	/* cube levels are 0, 95, 135, ..., 255; pick the closest one */
+	ri = r < 48 ? 0 : r < 115 ? 1 : (r - 35) / 40;
+	gi = g < 48 ? 0 : g < 115 ? 1 : (g - 35) / 40;
+	bi = b < 48 ? 0 : b < 115 ? 1 : (b - 35) / 40;
+
+	/* grayscale ramp is 8, 18, ..., 238 */
+	avg = (r + g + b) / 3;
+	gray = avg < 3 ? 0 : min((avg - 3) / 10, 23U);
+
+	if (devcon_rgb_dist(r, g, b, gray * 10 + 8, gray * 10 + 8,
+			    gray * 10 + 8) <
+	    devcon_rgb_dist(r, g, b, devcon_c256_levels[ri],
+			    devcon_c256_levels[gi], devcon_c256_levels[bi]))
+		return 232 + gray;
+
+	return 16 + ri * 36 + gi * 6 + bi;
+}
+#endif
+
+/**
+ * devcon_color_set_256() - Set color to an entry of the 256-color palette
+ * @color: color to set
+ * @c256: palette index
+ *
+ * With CONFIG_DEVCON_COLOR_16, the color is quantized to the closest of the 16
+ * ANSI colors.
+ */
+void devcon_color_set_256(struct devcon_color *color, u8 c256)
+{
+#if DEVCON_COLOR_DEPTH == 16
+	u32 r, g, b;
+
+	if (c256 >= 16) {
+		devcon_c256_to_rgb(c256, NULL, &r, &g, &b);
+		c256 = devcon_rgb_to_ansi(r, g, b);
+	}
+
+	color->ccode = DEVCON_CCODE_BLACK + c256;
+#else
+	color->ccode = DEVCON_CCODE_256;
+	color->c256 = c256;
+#endif
+}
+
+/**
+ * devcon_color_set_rgb() - Set color to an RGB value
+ * @color: color to set
+ * @r: red channel
+ * @g: green channel
+ * @b: blue channel
+ *
+ * With CONFIG_DEVCON_COLOR_256 or CONFIG_DEVCON_COLOR_16, the color is
+ * quantized to the closest color of the respective palette.
+ */
+void devcon_color_set_rgb(struct devcon_color *color, u8 r, u8 g, u8 b)
+{
+#if DEVCON_COLOR_DEPTH == 16
+	color->ccode = DEVCON_CCODE_BLACK + devcon_rgb_to_ansi(r, g, b);
+#elif DEVCON_COLOR_DEPTH == 256
+	color->ccode = DEVCON_CCODE_256;
+	color->c256 = devcon_rgb_to_256(r, g, b);
+#else
+	color->ccode = DEVCON_CCODE_RGB;
+	color->red = r;
+	color->green = g;
+	color->blue = b;
+#endif
+}
+
 static u32 devcon_color_to_argb32(const struct devcon_color *color,
 				  const struct devcon_attr *attr,
 				  const u8 *palette)
 {
-	static const u8 bval[] = {
-		0x00, 0x5f, 0x87,
-		0xaf, 0xd7, 0xff,
-	};
 	u32 r, g, b, t;
 
 	if (!palette)
 		palette = (void *)devcon_default_palette;
 
 	switch (color->ccode) {
+#if DEVCON_COLOR_DEPTH == 0
 	case DEVCON_CCODE_RGB:
 		r = color->red;
 		g = color->green;
 		b = color->blue;
 		break;
+#endif
+#if DEVCON_COLOR_DEPTH != 16
 	case DEVCON_CCODE_256:
-		t = color->c256;
-		if (t < 16) {
-			r = palette[t * 3 + 0];
-			g = palette[t * 3 + 1];
-			b = palette[t * 3 + 2];
-		} else if (t < 232) {
-			t -= 16;
-			b = bval[t % 6];
-			t /= 6;
-			g = bval[t % 6];
-			t /= 6;
-			r = bval[t % 6];
-		} else {
-			t = (t - 232) * 10 + 8;
-			r = t;
-			g = t;
-			b = t;
-		}
+		devcon_c256_to_rgb(color->c256, palette, &r, &g, &b);
 		break;
+#endif
 	case DEVCON_CCODE_BLACK ... DEVCON_CCODE_LIGHT_WHITE:
 		t = color->ccode - DEVCON_CCODE_BLACK;
 
@@ -535,6 +653,186 @@ void devcon_attr_to_argb32(const struct devcon_attr *attr,
 		*bg = b;
 }
 
+static bool devcon_color_equal(const struct devcon_color *a,
+			       const struct devcon_color *b)
+{
+	if (a->ccode != b->ccode)
+		return false;
+
+	switch (a->ccode) {
+#if DEVCON_COLOR_DEPTH != 16
+	case DEVCON_CCODE_256:
+		return a->c256 == b->c256;
+#endif
+#if DEVCON_COLOR_DEPTH == 0
+	case DEVCON_CCODE_RGB:
+		return a->red == b->red &&
+		       a->green == b->green &&
+		       a->blue == b->blue;
+#endif
+	default:
+		return true;
+	}
+}
+
+/**
+ * devcon_attr_equal() - Compare terminal attributes
+ * @a: first attributes
+ * @b: second attributes
+ *
+ * Returns: True if @a and @b are rendered identically, false otherwise.
+ */
+bool devcon_attr_equal(const struct devcon_attr *a,
+		       const struct devcon_attr *b)
+{
+	return devcon_color_equal(&a->fg, &b->fg) &&
+	       devcon_color_equal(&a->bg, &b->bg) &&
+	       a->bold == b->bold &&
+	       a->italic == b->italic &&
+	       a->underline == b->underline &&
+	       a->inverse == b->inverse &&
+	       a->protect == b->protect &&
+	       a->blink == b->blink &&
+	       a->hidden == b->hidden;
+}
+
+static u8 devcon_color_to_ansi(const struct devcon_color *color,
+				const struct devcon_attr *attr)
+{
+	unsigned int i;
+#if DEVCON_COLOR_DEPTH != 16
+	u32 r, g, b;
+#endif
+
+	switch (color->ccode) {
+#if DEVCON_COLOR_DEPTH == 0
+	case DEVCON_CCODE_RGB:
+		return devcon_rgb_to_ansi(color->red, color->green, color->blue);
+#endif
+#if DEVCON_COLOR_DEPTH != 16
+	case DEVCON_CCODE_256:
+		if (color->c256 < 16)
+			return color->c256;
+
+		devcon_c256_to_rgb(color->c256, NULL, &r, &g, &b);
+		return devcon_rgb_to_ansi(r, g, b);
+#endif
+	case DEVCON_CCODE_BLACK ... DEVCON_CCODE_LIGHT_WHITE:
+		i = color->ccode - DEVCON_CCODE_BLACK;
+
+		/* bold causes light colors (only for foreground colors) */
+		if (i < 8 && attr->bold && color == &attr->fg)
+			i += 8;
+
+		return i;
+	case DEVCON_CCODE_DEFAULT:
+		/* fallthrough */
+	default:
+		return (color == &attr->fg) ? 7 : 0;
+	}
+}
+
+/* ANSI color order to VGA color order; the default colors are kept as is */
+static const u8 devcon_ansi_to_vga[DEVCON_PALETTE_N] = {
+	0, 4, 2, 6, 1, 5, 3, 7, 8, 12, 10, 14, 9, 13, 11, 15,
+	DEVCON_PALETTE_FG, DEVCON_PALETTE_BG,
+};
+
+/* return the palette entry @color is rendered with */
+static u8 devcon_color_to_entry(const struct devcon_color *color,
+				const struct devcon_attr *attr)
+{
+	if (color->ccode == DEVCON_CCODE_DEFAULT)
+		return (color == &attr->fg) ? DEVCON_PALETTE_FG :
+					      DEVCON_PALETTE_BG;
+
+	return devcon_color_to_ansi(color, attr);
+}
+
+/**
+ * devcon_attr_to_vga() - Encode terminal colors as VGA palette indices
+ * @attr: Terminal attributes to work on
+ * @fg: Storage for foreground color (or NULL)
+ * @bg: Storage for background color (or NULL)
+ *
+ * This maps attr->fg and attr->bg to the closest color of the 16-color VGA
+ * palette, as used by the pseudo-palette of fbdev drivers. Default colors are
+ * returned as DEVCON_PALETTE_FG and DEVCON_PALETTE_BG, see
+ * devcon_palette_to_vga(). Inverse and hidden attributes are applied.
+ */
+void devcon_attr_to_vga(const struct devcon_attr *attr, u8 *fg, u8 *bg)
+{
+	u8 f, b, t;
+
+	f = devcon_ansi_to_vga[devcon_color_to_entry(&attr->fg, attr)];
+	b = devcon_ansi_to_vga[devcon_color_to_entry(&attr->bg, attr)];
+
+	if (attr->inverse) {
+		t = f;
+		f = b;
+		b = t;
+	}
+
+	if (attr->hidden)
+		f = b;
+
+	if (fg)
+		*fg = f;
+	if (bg)
+		*bg = b;
+}
+
+/**
+ * devcon_palette_reset() - Reset a palette entry to its default
+ * @palette: palette to modify
+ * @entry: entry to reset
+ */
+void devcon_palette_reset(u8 *palette, unsigned int entry)
+{
+	if (WARN_ON(entry >= DEVCON_PALETTE_N))
+		return;
+
+	memcpy(&palette[entry * 3], devcon_default_palette[entry], 3);
+}
+
+/**
+ * devcon_palette_get_256() - Resolve an entry of the 256-color palette
+ * @palette: palette to use for the first 16 entries (or NULL for default)
+ * @c256: palette index
+ * @rgb: storage for the red, green and blue channel
+ */
+void devcon_palette_get_256(const u8 *palette, u8 c256, u8 *rgb)
+{
+	u32 r, g, b;
+
+	if (!palette)
+		palette = (void *)devcon_default_palette;
+
+	devcon_c256_to_rgb(c256, palette, &r, &g, &b);
+	rgb[0] = r;
+	rgb[1] = g;
+	rgb[2] = b;
+}
+
+/**
+ * devcon_palette_to_vga() - Reorder a palette by VGA color index
+ * @palette: palette to convert (or NULL for default)
+ * @vga: storage for DEVCON_PALETTE_N RGB triples
+ *
+ * This stores the entries of @palette in @vga, in the order of the indices
+ * returned by devcon_attr_to_vga().
+ */
+void devcon_palette_to_vga(const u8 *palette, u8 *vga)
+{
+	unsigned int i;
+
+	if (!palette)
+		palette = (void *)devcon_default_palette;
+
+	for (i = 0; i < DEVCON_PALETTE_N; ++i)
+		memcpy(&vga[devcon_ansi_to_vga[i] * 3], &palette[i * 3], 3);
+}
+
 /**
  * devcon_cell_init() - Initialize a new cell
  * @cell: cell to initialize
@@ -706,6 +1004,38 @@ static void devcon_cell_clear_n(struct devcon_cell *cells,
 		devcon_cell_set(cells, DEVCON_CHAR_NULL, 0, attr, age);
 }
 
+/*
+ * Line bodies store the content of history lines. Only the first @fill cells
+ * are stored; the remaining cells up to @width are blanks with attributes
+ * @tail. Bodies are shared between lines with identical content and freed with
+ * their last reference. See devcon_history_push().
+ */
+struct devcon_line_body {
+	struct hlist_node node;		/* entry in history hashtable */
+	u32 hash;			/* content hash */
+	unsigned int refs;		/* # of lines using this body */
+
+	unsigned int width;		/* width of the line */
+	unsigned int fill;		/* # of stored cells */
+	struct devcon_attr tail;	/* attributes of cells beyond @fill */
+	struct devcon_cell cells[];	/* stored cells */
+};
+
+static size_t devcon_line_body_get_size(struct devcon_line_body *body)
+{
+	return sizeof(*body) + sizeof(*body->cells) * body->fill;
+}
+
+static void devcon_line_body_unref(struct devcon_line_body *body)
+{
+	if (!body || --body->refs)
+		return;
+
+	hash_del(&body->node);
+	devcon_cell_destroy_n(body->cells, body->fill);
+	kfree(body);
+}
+
 /**
  * devcon_line_new() - Allocate a new line
  * @out: place to store pointer to new line
@@ -722,7 +1052,7 @@ static int devcon_line_new(struct devcon_line **out)
 {
 	struct devcon_line *line;
 
-	line = kzalloc(sizeof(struct devcon_line), GFP_KERNEL);
+	line = kzalloc(sizeof(struct devcon_line), DEVCON_GFP);
 	if (!line)
 		return -ENOMEM;
 
@@ -747,6 +1077,7 @@ static struct devcon_line *devcon_line_free(struct devcon_line *line)
 	if (!line)
 		return NULL;
 
+	devcon_line_body_unref(line->body);
 	devcon_cell_destroy_n(line->cells, line->n_cells);
 	kfree(line->cells);
 	kfree(line);
@@ -755,70 +1086,127 @@ static struct devcon_line *devcon_line_free(struct devcon_line *line)
 }
 
 /**
- * devcon_line_reserve() - Pre-allocate cells for a line
- * @line: line to pre-allocate cells for
- * @width: numbers of cells the line shall have pre-allocated
- * @attr: attribute for all allocated cells or NULL
- * @age: current age for all modifications
- * @protect_width: width to protect from erasure
- *
- * This pre-allocates cells for this line. Please note that @width is the number
- * of cells the line is guaranteed to have allocated after this call returns.
- * It's not the number of cells that are added, neither is it the new width of
- * the line.
- *
- * This function never frees memory. That is, reducing the line-width will
- * always succeed, same is true for increasing the width to a previously set
- * width.
+ * devcon_line_materialize() - Allocate implied cells of a line
+ * @line: line to modify
+ * @num: number of cells that must be allocated
  *
- * @attr and @age are used to initialize new cells. Additionally, any
- * existing cell outside of the protected area specified by @protect_width are
- * cleared and reset with @attr and @age.
+ * Lines only allocate cells up to the right-most cell that was modified. All
+ * cells beyond line->n_cells are implied blanks with attributes line->erase
+ * and age line->erase_age. This allocates the first @num cells of @line, so
+ * they can be accessed directly. New cells are initialized as implied.
  *
  * Returns: 0 on success, negative error code on failure.
  */
-static int devcon_line_reserve(struct devcon_line *line,
-			       unsigned int width,
-			       const struct devcon_attr *attr,
-			       u64 age,
-			       unsigned int protect_width)
+static int devcon_line_materialize(struct devcon_line *line, unsigned int num)
 {
-	unsigned int min_width;
 	struct devcon_cell *t;
 
-	/* reset existing cells if required */
-	min_width = min(line->n_cells, width);
-	if (min_width > protect_width)
-		devcon_cell_clear_n(line->cells + protect_width,
-				    min_width - protect_width,
-				    attr,
-				    age);
+	if (num <= line->n_cells)
+		return 0;
+	if (num > SIZE_MAX / sizeof(*t))
+		return -ENOMEM;
 
-	/* allocate new cells if required */
+	t = krealloc(line->cells, sizeof(*t) * num, DEVCON_GFP);
+	if (!t)
+		return -ENOMEM;
 
-	if (width > line->n_cells) {
-		if (width > SIZE_MAX / sizeof(*t))
-			return -ENOMEM;
+	devcon_cell_init_n(t + line->n_cells,
+			   num - line->n_cells,
+			   &line->erase,
+			   line->erase_age);
 
-		t = krealloc(line->cells, sizeof(*t) * width, GFP_KERNEL);
-		if (!t)
-			return -ENOMEM;
+	line->cells = t;
+	line->n_cells = num;
+	return 0;
+}
 
-		if (!attr && !age)
-			memset(t + line->n_cells, 0,
-			       sizeof(*t) * (width - line->n_cells));
-		else
-			devcon_cell_init_n(t + line->n_cells,
-					   width - line->n_cells,
-					   attr,
-					   age);
+/* remember that @line might contain blinking cells, if @attr blinks */
+static void devcon_line_mark(struct devcon_line *line,
+			     const struct devcon_attr *attr)
+{
+	if (attr && attr->blink)
+		line->blink = true;
+}
+
+/**
+ * devcon_line_truncate() - Turn cells of a line into implied blanks
+ * @line: line to modify
+ * @from: first cell to truncate
+ * @attr: attributes for the implied blanks or NULL
+ * @age: age for the implied blanks
+ *
+ * This releases all cells starting at @from and turns them, and all cells to
+ * the right, into implied blanks with @attr and @age. The backing memory is
+ * kept, so re-allocating it later is cheap (see devcon_line_shrink()).
+ *
+ * If @from is beyond the allocated cells, the implied cells up to @from keep
+ * their attributes, hence, they're allocated first. If that fails, the
+ * attributes of those cells might change.
+ */
+static void devcon_line_truncate(struct devcon_line *line,
+				 unsigned int from,
+				 const struct devcon_attr *attr,
+				 u64 age)
+{
+	struct devcon_attr blank = {};
+
+	if (!attr)
+		attr = &blank;
 
-		line->cells = t;
-		line->n_cells = width;
+	if (from > line->n_cells && !devcon_attr_equal(&line->erase, attr))
+		devcon_line_materialize(line, from);
+
+	if (from < line->n_cells) {
+		devcon_cell_destroy_n(line->cells + from, line->n_cells - from);
+		line->n_cells = from;
 	}
 
-	line->fill = min(line->fill, protect_width);
+	line->erase = *attr;
+	line->erase_age = age;
+	line->fill = min(line->fill, line->n_cells);
+
+	/* if nothing is allocated, the erase attributes are all that's left */
+	if (!line->n_cells)
+		line->blink = attr->blink;
+	else
+		devcon_line_mark(line, attr);
+}
+
+/**
+ * devcon_line_reserve() - Prepare a line for a new width
+ * @line: line to prepare
+ * @attr: attribute for all reset cells or NULL
+ * @age: current age for all modifications
+ * @protect_width: width to protect from erasure
+ *
+ * This resets any cell outside of the protected area specified by
+ * @protect_width with @attr and @age. As cells are only allocated once
+ * they're modified (see devcon_line_materialize()), this allows to change the
+ * width of the line to any value afterwards. Note that no cells are allocated
+ * for new blanks, and existing cells beyond @protect_width are released.
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+static int devcon_line_reserve(struct devcon_line *line,
+			       const struct devcon_attr *attr,
+			       u64 age,
+			       unsigned int protect_width)
+{
+	struct devcon_attr blank = {};
+	int ret;
+
+	if (!attr)
+		attr = &blank;
+
+	/* implied cells within the protected area must keep their attributes */
+	if (protect_width > line->n_cells &&
+	    !devcon_attr_equal(&line->erase, attr)) {
+		ret = devcon_line_materialize(line, protect_width);
+		if (ret < 0)
+			return ret;
+	}
 
+	devcon_line_truncate(line, protect_width, attr, age);
 	return 0;
 }
 
@@ -827,13 +1215,12 @@ static int devcon_line_reserve(struct devcon_line *line,
  * @line: line to modify
  * @width: new width
  *
- * This changes the actual width of a line. It is the caller's responsibility
- * to use devcon_line_reserve() to make sure enough space is allocated. If
- * @width is greater than the allocated size, it is cropped.
- *
- * This does not modify any cells. Use devcon_line_reserve() or
+ * This changes the actual width of a line. Cells beyond the allocated cells
+ * are implied blanks, so any width is valid. Use devcon_line_reserve() or
  * devcon_line_erase() to clear any newly added cells.
  *
+ * This does not modify any cells.
+ *
  * NOTE: The fill state is cropped at line->width. Therefore, if you increase
  *       the line-width afterwards, but there is a multi-cell character at the
  *       end of the line that got cropped, then the fill-state will _not_ be
@@ -845,13 +1232,95 @@ static int devcon_line_reserve(struct devcon_line *line,
  */
 static void devcon_line_set_width(struct devcon_line *line, unsigned int width)
 {
-	if (width > line->n_cells)
-		width = line->n_cells;
-
 	line->width = width;
 	line->fill = min(line->fill, width);
 }
 
+/**
+ * devcon_line_get_size() - Return memory used by a line
+ * @line: line to query
+ *
+ * Returns: Number of bytes allocated for @line, including its cells.
+ */
+static size_t devcon_line_get_size(struct devcon_line *line)
+{
+	size_t size;
+
+	size = sizeof(*line) + sizeof(*line->cells) * line->n_cells;
+
+	/* shared bodies are only accounted to their last user */
+	if (line->body && line->body->refs == 1)
+		size += devcon_line_body_get_size(line->body);
+
+	return size;
+}
+
+/**
+ * devcon_line_get_slack() - Return the number of unused cells of a line
+ * @line: line to query
+ *
+ * This returns the number of allocated cells at the end of @line that are
+ * identical to its implied blanks, that is, the number of cells
+ * devcon_line_shrink() would release. Cells within the fill-state, including
+ * the tail of a multi-cell character at its end, are always kept.
+ *
+ * Returns: Number of cells that can be released.
+ */
+static unsigned int devcon_line_get_slack(struct devcon_line *line)
+{
+	unsigned int keep = line->fill, n;
+
+	if (keep > 0 && line->cells[keep - 1].cwidth > 1)
+		keep = min(keep - 1 + line->cells[keep - 1].cwidth,
+			   line->n_cells);
+
+	for (n = line->n_cells; n > keep; --n)
+		if (!devcon_attr_equal(&line->cells[n - 1].attr, &line->erase))
+			break;
+
+	return line->n_cells - n;
+}
+
+/**
+ * devcon_line_shrink() - Release unused cells of a line
+ * @line: line to shrink
+ * @gfp: allocation flags for the shrunk cell-array
+ *
+ * This releases all cells at the end of @line that are identical to its
+ * implied blanks (see devcon_line_get_slack()). The visible content of @line
+ * is not changed.
+ *
+ * As krealloc() never returns memory when shrinking, a new cell-array is
+ * allocated with @gfp. If that fails, the line is left untouched.
+ *
+ * Returns: Number of bytes released.
+ */
+static size_t devcon_line_shrink(struct devcon_line *line, gfp_t gfp)
+{
+	unsigned int slack, keep;
+	struct devcon_cell *t = NULL;
+
+	slack = devcon_line_get_slack(line);
+	if (!slack)
+		return 0;
+
+	keep = line->n_cells - slack;
+	if (keep > 0) {
+		t = kmalloc(sizeof(*t) * keep, gfp);
+		if (!t)
+			return 0;
+
+		memcpy(t, line->cells, sizeof(*t) * keep);
+	}
+
+	devcon_cell_destroy_n(line->cells + keep, slack);
+	kfree(line->cells);
+	line->cells = t;
+	line->n_cells = keep;
+
+	return sizeof(*t) * slack;
+}
+
 /**
  * devcon_line_place() - Insert characters and move existing cells to the right
  * @from: position to insert cells at
@@ -878,7 +1347,7 @@ static void devcon_line_place(struct devcon_line *line,
 			      const struct devcon_attr *attr,
 			      u64 age)
 {
-	unsigned int i, rem, move;
+	unsigned int i, rem, move, width;
 
 	if (from >= line->width)
 		return;
@@ -887,7 +1356,20 @@ static void devcon_line_place(struct devcon_line *line,
 	if (!num)
 		return;
 
-	move = line->width - from - num;
+	/*
+	 * Implied blanks are all equal, so shifting them is a no-op. Hence, we
+	 * only need to operate on the allocated cells, plus the @num cells that
+	 * are shifted into the implied area.
+	 */
+	width = min(line->width, max(line->n_cells, from) + num);
+	if (devcon_line_materialize(line, width) < 0) {
+		devcon_char_free(head_char);
+		return;
+	}
+
+	devcon_line_mark(line, attr);
+
+	move = width - from - num;
 	rem = min(num, move);
 
 	if (rem > 0) {
@@ -907,7 +1389,7 @@ static void devcon_line_place(struct devcon_line *line,
 		 */
 
 		/* destroy cells that are knocked off on the right */
-		devcon_cell_destroy_n(line->cells + line->width - rem, rem);
+		devcon_cell_destroy_n(line->cells + width - rem, rem);
 
 		/* move remaining bulk of cells */
 		memmove(line->cells + from + num,
@@ -932,7 +1414,7 @@ static void devcon_line_place(struct devcon_line *line,
 				   age);
 
 		/* adjust fill-state */
-		line->fill = min(line->width,
+		line->fill = min(width,
 				 max(line->fill + num,
 				     from + num));
 	} else {
@@ -950,7 +1432,7 @@ static void devcon_line_place(struct devcon_line *line,
 				    age);
 
 		/* adjust fill-state */
-		line->fill = line->width;
+		line->fill = width;
 	}
 }
 
@@ -998,6 +1480,13 @@ static void devcon_line_write(struct devcon_line *line,
 		 * fill the remains with NULLs. */
 		devcon_line_place(line, pos_x, len, ch, cwidth, attr, age);
 	} else {
+		if (devcon_line_materialize(line, pos_x + len) < 0) {
+			devcon_char_free(ch);
+			return;
+		}
+
+		devcon_line_mark(line, attr);
+
 		/* modify head-cell */
 		devcon_cell_set(line->cells + pos_x, ch, cwidth, attr, age);
 
@@ -1055,17 +1544,34 @@ static void devcon_line_delete(struct devcon_line *line,
 			       const struct devcon_attr *attr,
 			       u64 age)
 {
-	unsigned int rem, move, i;
+	struct devcon_attr blank = {};
+	unsigned int rem, move, i, width;
 
-	if (from >= line->width)
+	if (!attr)
+		attr = &blank;
+
+	/*
+	 * If the new cells on the right are equal to the implied blanks, only
+	 * the allocated cells need to be shifted. Otherwise, all cells are
+	 * allocated.
+	 */
+	width = line->width;
+	if (devcon_attr_equal(attr, &line->erase))
+		width = min(width, line->n_cells);
+	else if (devcon_line_materialize(line, width) < 0)
 		return;
-	if (from + num < from || from + num > line->width)
-		num = line->width - from;
+
+	if (from >= width)
+		return;
+	if (from + num < from || from + num > width)
+		num = width - from;
 	if (!num)
 		return;
 
+	devcon_line_mark(line, attr);
+
 	/* destroy and move as many upfront as possible */
-	move = line->width - from - num;
+	move = width - from - num;
 	rem = min(num, move);
 	if (rem > 0) {
 		/* destroy to be removed cells */
@@ -1081,7 +1587,7 @@ static void devcon_line_delete(struct devcon_line *line,
 			line->cells[from + i].age = age;
 
 		/* initialize tail that was moved away */
-		devcon_cell_init_n(line->cells + line->width - rem,
+		devcon_cell_init_n(line->cells + width - rem,
 				   rem,
 				   attr,
 				   age);
@@ -1127,8 +1633,11 @@ static void devcon_line_append(struct devcon_line *line,
 {
 	if (pos_x >= line->width)
 		return;
+	if (devcon_line_materialize(line, pos_x + 1) < 0)
+		return;
 
 	devcon_cell_append(line->cells + pos_x, ucs4, age);
+	line->fill = max(line->fill, pos_x + 1);
 }
 
 /**
@@ -1153,8 +1662,9 @@ static void devcon_line_erase(struct devcon_line *line,
 			      u64 age,
 			      bool keep_protected)
 {
-	unsigned int i, last_protected;
+	unsigned int i, n, last_protected, keep;
 	struct devcon_cell *cell;
+	bool truncate;
 
 	if (from >= line->width)
 		return;
@@ -1163,20 +1673,42 @@ static void devcon_line_erase(struct devcon_line *line,
 	if (!num)
 		return;
 
+	/*
+	 * If the erase covers the end of the line, the erased cells become
+	 * implied blanks. Only the allocated cells need to be erased one by
+	 * one, as some of them might be protected.
+	 */
+	truncate = from + num == line->width &&
+		   !(keep_protected && line->erase.protect);
+	if (truncate) {
+		n = LESS_BY(min(line->n_cells, from + num), from);
+	} else {
+		n = num;
+		if (devcon_line_materialize(line, from + num) < 0)
+			return;
+	}
+
+	devcon_line_mark(line, attr);
+
 	last_protected = 0;
-	for (i = 0; i < num; ++i) {
+	keep = from;
+	for (i = 0; i < n; ++i) {
 		cell = line->cells + from + i;
 		if (keep_protected && cell->attr.protect) {
 			/* only count protected-cells inside the fill-region */
 			if (from + i < line->fill)
-				last_protected = from + i;
+				last_protected = from + i + 1;
 
+			keep = from + i + 1;
 			continue;
 		}
 
 		devcon_cell_set(cell, DEVCON_CHAR_NULL, 0, attr, age);
 	}
 
+	if (truncate)
+		devcon_line_truncate(line, keep, attr, age);
+
 	/* Adjust fill-state. This is a bit tricky, we can only adjust it in
 	 * case the erase-region starts inside the fill-region and ends at the
 	 * tail or beyond the fill-region. Otherwise, the current fill-state
@@ -1217,7 +1749,7 @@ int devcon_page_new(struct devcon_page **out)
 {
 	struct devcon_page *page;
 
-	page = kzalloc(sizeof(struct devcon_page), GFP_KERNEL);
+	page = kzalloc(sizeof(struct devcon_page), DEVCON_GFP);
 	if (!page)
 		return -ENOMEM;
 
@@ -1250,6 +1782,58 @@ struct devcon_page *devcon_page_free(struct devcon_page *page) {
 	return NULL;
 }
 
+/**
+ * devcon_page_get_size() - Return memory used by a page
+ * @page: page to query
+ *
+ * Returns: Number of bytes allocated for lines and cells of @page.
+ */
+size_t devcon_page_get_size(struct devcon_page *page)
+{
+	size_t size;
+	unsigned int i;
+
+	size = sizeof(*page->lines) * page->n_lines * 2;
+	for (i = 0; i < page->n_lines; ++i)
+		size += devcon_line_get_size(page->lines[i]);
+
+	return size;
+}
+
+/**
+ * devcon_page_release() - Release all lines of a page
+ * @page: page to modify
+ *
+ * This frees all lines and cells of @page and resets it to an empty page with
+ * zero width and height. Use devcon_page_reserve() and devcon_page_resize() to
+ * make it usable again.
+ *
+ * Returns: Number of bytes released.
+ */
+size_t devcon_page_release(struct devcon_page *page)
+{
+	size_t size;
+	unsigned int i;
+
+	size = devcon_page_get_size(page);
+
+	for (i = 0; i < page->n_lines; ++i)
+		devcon_line_free(page->lines[i]);
+
+	kfree(page->line_cache);
+	kfree(page->lines);
+	page->lines = NULL;
+	page->line_cache = NULL;
+	page->n_lines = 0;
+	page->width = 0;
+	page->height = 0;
+	page->scroll_idx = 0;
+	page->scroll_num = 0;
+	page->scroll_fill = 0;
+
+	return size;
+}
+
 /**
  * devcon_page_get_cell() - Return pointer to requested cell
  * @page: page to operate on
@@ -1260,7 +1844,11 @@ struct devcon_page *devcon_page_free(struct devcon_page *page) {
  * this cell as much as you like. However, once you call any other function on
  * the page, you must drop the pointer to the cell.
  *
- * Returns: Pointer to the cell or NULL if out of the visible area.
+ * Cells are only allocated once they're modified, so this might allocate the
+ * cell. Use devcon_page_age_cell() to just mark a cell as modified.
+ *
+ * Returns: Pointer to the cell or NULL if out of the visible area, or on
+ *          allocation failure.
  */
 struct devcon_cell *devcon_page_get_cell(struct devcon_page *page,
 					 unsigned int x,
@@ -1272,14 +1860,138 @@ struct devcon_cell *devcon_page_get_cell(struct devcon_page *page,
 		return NULL;
 	if (x >= page->lines[y]->width)
 		return NULL;
+	if (devcon_line_materialize(page->lines[y], x + 1) < 0)
+		return NULL;
 
 	return &page->lines[y]->cells[x];
 }
 
+/**
+ * devcon_page_age_cell() - Mark a cell as modified
+ * @page: page to operate on
+ * @x: x-position of cell
+ * @y: y-position of cell
+ * @age: age to set
+ *
+ * This sets the age of the cell at position @x/@y to @age, so it is redrawn.
+ * Unlike devcon_page_get_cell(), this never allocates the cell. If it is an
+ * implied blank, all implied blanks of its line are aged.
+ */
+void devcon_page_age_cell(struct devcon_page *page,
+			  unsigned int x,
+			  unsigned int y,
+			  u64 age)
+{
+	struct devcon_line *line;
+
+	if (x >= page->width || y >= page->height)
+		return;
+
+	line = page->lines[y];
+	if (x < line->n_cells)
+		line->cells[x].age = age;
+	else
+		line->erase_age = age;
+}
+
+/* return true if @attr is rendered with any palette entry in @mask */
+static bool devcon_attr_uses_palette(const struct devcon_attr *attr, u32 mask)
+{
+	return mask & (BIT(devcon_color_to_entry(&attr->fg, attr)) |
+		       BIT(devcon_color_to_entry(&attr->bg, attr)));
+}
+
+/**
+ * devcon_page_age_palette() - Mark cells using given palette entries modified
+ * @page: page to operate on
+ * @mask: bitmask of palette entries
+ * @age: age to set
+ *
+ * This sets the age of all cells that are rendered with any of the palette
+ * entries in @mask, so they are redrawn after the palette changed. Cells are
+ * never allocated by this.
+ */
+void devcon_page_age_palette(struct devcon_page *page, u32 mask, u64 age)
+{
+	struct devcon_line *line;
+	unsigned int i, j;
+
+	for (j = 0; j < page->height; ++j) {
+		line = page->lines[j];
+
+		for (i = 0; i < line->n_cells; ++i)
+			if (devcon_attr_uses_palette(&line->cells[i].attr, mask))
+				line->cells[i].age = age;
+
+		if (devcon_attr_uses_palette(&line->erase, mask))
+			line->erase_age = age;
+	}
+}
+
+/**
+ * devcon_page_has_blink() - Check whether a page might contain blinking cells
+ * @page: page to query
+ *
+ * Returns: True if any visible line might contain cells with the blink
+ *          attribute set, false if none does.
+ */
+bool devcon_page_has_blink(struct devcon_page *page)
+{
+	unsigned int j;
+
+	for (j = 0; j < page->height; ++j)
+		if (page->lines[j]->blink)
+			return true;
+
+	return false;
+}
+
+/**
+ * devcon_page_age_blink() - Mark blinking cells modified
+ * @page: page to operate on
+ * @age: age to set
+ *
+ * This sets the age of all visible cells with the blink attribute set. Only
+ * lines that might contain such cells are scanned, and lines found to contain
+ * none are not scanned again until blinking cells are written to them.
+ *
+ * Returns: True if any cell was aged, false otherwise.
+ */
+bool devcon_page_age_blink(struct devcon_page *page, u64 age)
+{
+	struct devcon_line *line;
+	unsigned int i, j;
+	bool aged = false, found;
+
+	for (j = 0; j < page->height; ++j) {
+		line = page->lines[j];
+		if (!line->blink)
+			continue;
+
+		/* hidden cells are aged, too, so the flag stays accurate */
+		found = false;
+		for (i = 0; i < line->n_cells; ++i) {
+			if (line->cells[i].attr.blink) {
+				line->cells[i].age = age;
+				found = true;
+			}
+		}
+
+		if (line->erase.blink) {
+			line->erase_age = age;
+			found = true;
+		}
+
+		line->blink = found;
+		aged |= found;
+	}
+
+	return aged;
+}
+
 /**
  * devcon_page_up() - Scroll up
  * @page: page to operate on
- * @new_width: width to use for any new line moved into the visible area
  * @num: number of lines to scroll up
  * @attr: attributes to set on new lines
  * @age: age to use for all modifications
@@ -1287,16 +1999,12 @@ struct devcon_cell *devcon_page_get_cell(struct devcon_page *page,
  *
  * This scrolls the scroll-region by @num lines. New lines are cleared and reset
  * with the given attributes. Old lines are moved into the history if non-NULL.
- * If a new line is allocated, moved from the history buffer or moved from
- * outside the visible region into the visible region, this call makes sure it
- * has at least @width cells allocated. If a possible memory-allocation fails,
- * the previous line is reused. This has the side effect, that it will not be
- * linked into the history buffer.
+ * If a possible memory-allocation fails, the previous line is reused. This has
+ * the side effect, that it will not be linked into the history buffer.
  *
  * If the scroll-region is empty, this is a no-op.
  */
 static void devcon_page_up(struct devcon_page *page,
-			   unsigned int new_width,
 			   unsigned int num,
 			   const struct devcon_attr *attr,
 			   u64 age,
@@ -1311,10 +2019,6 @@ static void devcon_page_up(struct devcon_page *page,
 	if (num < 1)
 		return;
 
-	/* Better safe than sorry: avoid under-allocating lines, even when
-	 * resizing. */
-	new_width = max(new_width, page->width);
-
 	cache = page->line_cache;
 
 	/* Try moving lines into history and allocate new lines for each moved
@@ -1330,7 +2034,6 @@ static void devcon_page_up(struct devcon_page *page,
 			ret = devcon_line_new(&cache[i]);
 			if (ret >= 0) {
 				ret = devcon_line_reserve(cache[i],
-							  new_width,
 							  attr,
 							  age,
 							  0);
@@ -1386,11 +2089,10 @@ static void devcon_page_up(struct devcon_page *page,
  * you might want to include history-lines in the new area. In that case, you
  * should set @history to non-NULL.
  *
- * If a new line is allocated, moved from the history buffer or moved from
- * outside the visible region into the visible region, this call makes sure it
- * has at least @width cells allocated. If a possible memory-allocation fails,
- * the previous line is reused. This will have the side-effect that lines from
- * the history will not get visible on-screen but kept in history.
+ * History lines are only prepared for the new width once they are retrieved.
+ * If that fails, the region is only scrolled by the number of lines retrieved
+ * so far. The remaining lines are kept in history and stay available as
+ * scrollback.
  *
  * If the scroll-region is empty, this is a no-op.
  */
@@ -1423,8 +2125,19 @@ static void devcon_page_down(struct devcon_page *page,
 		line = page->lines[last_idx - i];
 
 		t = NULL;
-		if (history)
+		if (history) {
 			t = devcon_history_pop(history, new_width, attr, age);
+			if (!t && history->n_lines > 0) {
+				/* only scroll by the lines we got so far */
+				if (!i)
+					return;
+
+				memmove(cache, cache + num - i,
+					sizeof(*cache) * i);
+				num = i;
+				break;
+			}
+		}
 
 		if (t) {
 			cache[num - 1 - i] = t;
@@ -1489,22 +2202,22 @@ int devcon_page_reserve(struct devcon_page *page,
 	int ret;
 
 	/*
-	 * First make sure the first min(page->n_lines, rows) lines have at
-	 * least the required width of @cols. This does not modify any visible
-	 * cells in the existing @page->width x @page->height area, therefore,
-	 * we can safely bail out afterwards in case anything else fails.
-	 * Note that lines in between page->height and page->n_lines might be
-	 * shorter than page->width. Hence, we need to resize them all, but we
-	 * can skip some of them for better performance.
+	 * First make sure the first min(page->n_lines, rows) lines are cleared
+	 * beyond the visible area, so they can be widened to @cols. This does
+	 * not modify any visible cells in the existing @page->width x
+	 * @page->height area, therefore, we can safely bail out afterwards in
+	 * case anything else fails.
+	 * Note that lines in between page->height and page->n_lines might
+	 * contain stale cells. Hence, we need to reset them all, but we can
+	 * skip some of them for better performance.
 	 */
 	min_lines = min(page->n_lines, rows);
 	for (i = 0; i < min_lines; ++i) {
-		/* lines below page->height have at least page->width cells */
+		/* visible lines are not widened, nothing to clear */
 		if (cols < page->width && i < page->height)
 			continue;
 
 		ret = devcon_line_reserve(page->lines[i],
-					  cols,
 					  attr,
 					  age,
 					  (i < page->height) ? page->width : 0);
@@ -1522,12 +2235,12 @@ int devcon_page_reserve(struct devcon_page *page,
 		if (rows > SIZE_MAX / sizeof(*t))
 			return -ENOMEM;
 
-		t = krealloc(page->lines, sizeof(*t) * rows, GFP_KERNEL);
+		t = krealloc(page->lines, sizeof(*t) * rows, DEVCON_GFP);
 		if (!t)
 			return -ENOMEM;
 		page->lines = t;
 
-		t = krealloc(page->line_cache, sizeof(*t) * rows, GFP_KERNEL);
+		t = krealloc(page->line_cache, sizeof(*t) * rows, DEVCON_GFP);
 		if (!t)
 			return -ENOMEM;
 		page->line_cache = t;
@@ -1537,7 +2250,7 @@ int devcon_page_reserve(struct devcon_page *page,
 			if (ret < 0)
 				return ret;
 
-			ret = devcon_line_reserve(line, cols, attr, age, 0);
+			ret = devcon_line_reserve(line, attr, age, 0);
 			if (ret < 0) {
 				devcon_line_free(line);
 				return ret;
@@ -1594,7 +2307,6 @@ void devcon_page_resize(struct devcon_page *page,
 		empty = page->scroll_num - page->scroll_fill;
 		if (num > empty)
 			devcon_page_up(page,
-				       cols,
 				       num - empty,
 				       attr,
 				       age,
@@ -1654,11 +2366,7 @@ void devcon_page_resize(struct devcon_page *page,
 
 		/* check how many lines can be received from history */
 		if (history)
-			num = devcon_history_peek(history,
-						  rows - old_height,
-						  cols,
-						  attr,
-						  age);
+			num = devcon_history_peek(history, rows - old_height);
 		else
 			num = 0;
 
@@ -1907,7 +2615,7 @@ void devcon_page_scroll_up(struct devcon_page *page,
 			   u64 age,
 			   struct devcon_history *history)
 {
-	devcon_page_up(page, page->width, num, attr, age, history);
+	devcon_page_up(page, num, attr, age, history);
 }
 
 /**
@@ -2052,11 +2760,12 @@ int devcon_history_new(struct devcon_history **out)
 {
 	struct devcon_history *history;
 
-	history = kzalloc(sizeof(struct devcon_history), GFP_KERNEL);
+	history = kzalloc(sizeof(struct devcon_history), DEVCON_GFP);
 	if (!history)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&history->lines);
+	hash_init(history->bodies);
 	history->max_lines = 4096;
 
 	*out = history;
@@ -2077,10 +2786,78 @@ struct devcon_history *devcon_history_free(struct devcon_history *history)
 		return NULL;
 
 	devcon_history_clear(history);
+	kfree(history->marks);
 	kfree(history);
 	return NULL;
 }
 
+/*
+ * Unlink and free the oldest line of @history. Marks that only covered lines
+ * up to it are dropped. The first remaining mark always covers the oldest
+ * line, even if its block started before.
+ */
+static void devcon_history_drop(struct devcon_history *history)
+{
+	struct devcon_line *line;
+
+	line = list_first_entry(&history->lines, struct devcon_line, list);
+	list_del_init(&line->list);
+	devcon_line_free(line);
+	--history->n_lines;
+	++history->seq;
+
+	while (history->n_marks - history->i_marks > 1 &&
+	       history->marks[history->i_marks + 1].seq <= history->seq)
+		++history->i_marks;
+
+	if (!history->n_lines)
+		history->i_marks = history->n_marks = 0;
+}
+
+/*
+ * Record that line @seq was pushed at @time. If the block of the last mark
+ * has the same time, the line simply joins it. If the clock went backwards,
+ * the line joins the last block as well, so marks stay sorted. If we cannot
+ * allocate a new mark, the line joins the last block, too, and only the
+ * precision of the index suffers.
+ */
+static void devcon_history_mark(struct devcon_history *history,
+				u64 seq,
+				time64_t time)
+{
+	struct devcon_history_mark *marks;
+	unsigned int n;
+
+	if (history->n_marks > history->i_marks &&
+	    time <= history->marks[history->n_marks - 1].time)
+		return;
+
+	if (history->n_marks >= history->max_marks) {
+		/* grow only if compacting would not free up half of the array */
+		n = history->n_marks - history->i_marks;
+		if (n >= history->max_marks / 2) {
+			marks = krealloc(history->marks,
+					 max(16U, history->max_marks * 2) *
+						sizeof(*marks),
+					 DEVCON_GFP);
+			if (!marks)
+				return;
+
+			history->marks = marks;
+			history->max_marks = max(16U, history->max_marks * 2);
+		}
+
+		memmove(history->marks, history->marks + history->i_marks,
+			n * sizeof(*marks));
+		history->i_marks = 0;
+		history->n_marks = n;
+	}
+
+	history->marks[history->n_marks].seq = seq;
+	history->marks[history->n_marks].time = time;
+	++history->n_marks;
+}
+
 /**
  * devcon_history_clear() - Clear history
  * @history: history to clear
@@ -2102,18 +2879,260 @@ void devcon_history_clear(struct devcon_history *history)
  */
 void devcon_history_trim(struct devcon_history *history, unsigned int max)
 {
-	struct devcon_line *line;
-
 	if (!history)
 		return;
 
-	while (history->n_lines > max && !list_empty(&history->lines)) {
+	while (history->n_lines > max && !list_empty(&history->lines))
+		devcon_history_drop(history);
+}
+
+/**
+ * devcon_history_get_size() - Return memory used by a history
+ * @history: history to query
+ *
+ * Returns: Number of bytes allocated for lines, cells and bodies of @history.
+ */
+size_t devcon_history_get_size(struct devcon_history *history)
+{
+	struct devcon_line_body *body;
+	struct devcon_line *line;
+	size_t size = 0;
+	unsigned int i;
+
+	list_for_each_entry(line, &history->lines, list)
+		size += sizeof(*line) + sizeof(*line->cells) * line->n_cells;
+
+	hash_for_each(history->bodies, i, body, node)
+		size += devcon_line_body_get_size(body);
+
+	size += sizeof(*history->marks) * history->max_marks;
+
+	return size;
+}
+
+/**
+ * devcon_history_get_reclaimable() - Return reclaimable history memory
+ * @history: history to query
+ * @floor: number of recent lines that are never trimmed
+ *
+ * This returns the number of bytes devcon_history_shrink() could release with
+ * the same @floor. That is, the size of all lines beyond the @floor most recent
+ * lines, plus the unused cells of the remaining lines.
+ *
+ * Returns: Number of reclaimable bytes.
+ */
+size_t devcon_history_get_reclaimable(struct devcon_history *history,
+				      unsigned int floor)
+{
+	struct devcon_line *line;
+	unsigned int num = 0;
+	size_t size = 0;
+
+	list_for_each_entry_reverse(line, &history->lines, list) {
+		if (num++ < floor)
+			size += sizeof(*line->cells) *
+				devcon_line_get_slack(line);
+		else
+			size += devcon_line_get_size(line);
+	}
+
+	return size;
+}
+
+/**
+ * devcon_history_shrink() - Release history memory
+ * @history: history to shrink
+ * @floor: number of recent lines that are never trimmed
+ * @target: number of bytes to release
+ * @gfp: allocation flags for shrunk cell-arrays
+ *
+ * This releases up to roughly @target bytes of @history. First, the oldest
+ * lines beyond the @floor most recent lines are dropped. If that is not
+ * enough, unused cells of the remaining lines are released, starting with the
+ * oldest line. See devcon_line_shrink().
+ *
+ * Returns: Number of bytes released.
+ */
+size_t devcon_history_shrink(struct devcon_history *history,
+			     unsigned int floor,
+			     size_t target,
+			     gfp_t gfp)
+{
+	struct devcon_line *line;
+	size_t size = 0;
+
+	while (size < target && history->n_lines > floor &&
+	       !list_empty(&history->lines)) {
 		line = list_first_entry(&history->lines,
-				       struct devcon_line, list);
-		list_del_init(&line->list);
-		devcon_line_free(line);
-		--history->n_lines;
+					struct devcon_line, list);
+		size += devcon_line_get_size(line);
+		devcon_history_drop(history);
 	}
+
+	list_for_each_entry(line, &history->lines, list) {
+		if (size >= target)
+			break;
+
+		size += devcon_line_shrink(line, gfp);
+	}
+
+	return size;
+}
+
+/*
+ * Return the number of cells of @line that need to be stored in a body. All
+ * cells beyond are blank with attributes line->erase.
+ */
+static unsigned int devcon_history_get_fill(struct devcon_line *line)
+{
+	return min(line->n_cells - devcon_line_get_slack(line), line->width);
+}
+
+static u32 devcon_history_hash(struct devcon_line *line, unsigned int fill)
+{
+	struct devcon_charbuf buf;
+	const u32 *ch;
+	unsigned int i;
+	u32 hash;
+	size_t n;
+
+	hash = line->width * 31 + fill;
+	for (i = 0; i < fill; ++i) {
+		ch = devcon_char_resolve(line->cells[i].ch, &n, &buf);
+		hash = jhash2(ch, n, hash ^ line->cells[i].cwidth);
+	}
+
+	return hash;
+}
+
+static bool devcon_history_body_equal(struct devcon_line_body *body,
+				      struct devcon_line *line,
+				      unsigned int fill,
+				      u32 hash)
+{
+	const struct devcon_cell *a, *b;
+	unsigned int i;
+
+	if (body->hash != hash || body->width != line->width ||
+	    body->fill != fill)
+		return false;
+
+	if (fill < line->width && !devcon_attr_equal(&body->tail, &line->erase))
+		return false;
+
+	for (i = 0; i < fill; ++i) {
+		a = &body->cells[i];
+		b = &line->cells[i];
+		if (a->cwidth != b->cwidth ||
+		    !devcon_char_equal(a->ch, b->ch) ||
+		    !devcon_attr_equal(&a->attr, &b->attr))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Move the content of @line into a body. If a body with identical content is
+ * already linked in @history, it is shared, otherwise a new body is created.
+ * On allocation failure, @line keeps its cells, which is just fine.
+ */
+static void devcon_history_intern(struct devcon_history *history,
+				  struct devcon_line *line)
+{
+	struct devcon_line_body *body;
+	unsigned int fill;
+	u32 hash;
+
+	if (WARN_ON(line->body))
+		return;
+
+	fill = devcon_history_get_fill(line);
+	hash = devcon_history_hash(line, fill);
+
+	hash_for_each_possible(history->bodies, body, node, hash) {
+		if (devcon_history_body_equal(body, line, fill, hash)) {
+			++body->refs;
+			devcon_cell_destroy_n(line->cells, line->n_cells);
+			goto done;
+		}
+	}
+
+	body = kmalloc(sizeof(*body) + sizeof(*body->cells) * fill,
+		       DEVCON_GFP);
+	if (!body)
+		return;
+
+	body->hash = hash;
+	body->refs = 1;
+	body->width = line->width;
+	body->fill = fill;
+	body->tail = line->erase;
+
+	/* the stored cells are moved, so their characters are not destroyed */
+	memcpy(body->cells, line->cells, sizeof(*body->cells) * fill);
+	devcon_cell_destroy_n(line->cells + fill, line->n_cells - fill);
+	hash_add(history->bodies, &body->node, hash);
+
+done:
+	kfree(line->cells);
+	line->cells = NULL;
+	line->n_cells = 0;
+	line->fill = 0;
+	line->body = body;
+}
+
+/*
+ * Copy the content of a shared body back into @line and prepare it for a new
+ * width (see devcon_line_reserve()). Cells beyond the body are initialized
+ * with @attr. All cells get @age set, as their previous age is unknown.
+ */
+static int devcon_history_unshare(struct devcon_line *line,
+				  const struct devcon_attr *attr,
+				  u64 age)
+{
+	struct devcon_line_body *body = line->body;
+	struct devcon_cell *t = NULL;
+	unsigned int i;
+
+	if (!body)
+		return devcon_line_reserve(line, attr, age, line->width);
+
+	if (body->fill > 0) {
+		t = kmalloc(sizeof(*t) * body->fill, DEVCON_GFP);
+		if (!t)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < body->fill; ++i)
+		devcon_cell_init(&t[i], devcon_char_dup(body->cells[i].ch),
+				 body->cells[i].cwidth, &body->cells[i].attr,
+				 age);
+
+	line->cells = t;
+	line->n_cells = body->fill;
+	line->width = body->width;
+	line->fill = body->fill;
+	line->erase = body->tail;
+	line->erase_age = age;
+	line->body = NULL;
+	devcon_line_body_unref(body);
+
+	return devcon_line_reserve(line, attr, age, line->width);
+}
+
+/* push @line into @history, stamped with @time */
+static void devcon_history_push_at(struct devcon_history *history,
+				   struct devcon_line *line,
+				   time64_t time)
+{
+	devcon_history_intern(history, line);
+	devcon_history_mark(history, history->seq + history->n_lines, time);
+
+	list_add_tail(&line->list, &history->lines);
+	++history->n_lines;
+	if (history->n_lines > history->max_lines)
+		devcon_history_drop(history);
 }
 
 /**
@@ -2122,20 +3141,16 @@ void devcon_history_trim(struct devcon_history *history, unsigned int max)
  * @line: line to push into history
  *
  * This pushes a line into the given history. It is linked at the tail. In case
- * the history is limited, the top-most line might be freed.
+ * the history is limited, the top-most line might be freed. The line is
+ * stamped with the current wall-clock time, see devcon_history_find_time().
+ *
+ * The content of @line is moved into a body shared with all other lines of
+ * identical content, so repeated lines (and blank lines) are only stored once.
  */
 void devcon_history_push(struct devcon_history *history,
 			 struct devcon_line *line)
 {
-	list_add_tail(&line->list, &history->lines);
-	if (history->n_lines >= history->max_lines) {
-		line = list_first_entry(&history->lines,
-					struct devcon_line, list);
-		list_del_init(&line->list);
-		devcon_line_free(line);
-	} else {
-		++history->n_lines;
-	}
+	devcon_history_push_at(history, line, ktime_get_real_seconds());
 }
 
 /**
@@ -2146,8 +3161,8 @@ void devcon_history_push(struct devcon_history *history,
  * @age: age to use for cell reservation
  *
  * This unlinks the last linked line of the history and returns it. This also
- * makes sure the line has the given width pre-allocated (see
- * devcon_line_reserve()). If the pre-allocation fails, this returns NULL, so it
+ * prepares the line for the given width (see devcon_line_reserve()), which
+ * requires copying shared content. If that fails, this returns NULL, so it
  * is treated like there's no line in history left. This simplifies
  * history-handling on the caller's side in case of allocation errors. No need
  * to throw lines away just because the reservation failed. We can keep them in
@@ -2168,7 +3183,7 @@ struct devcon_line *devcon_history_pop(struct devcon_history *history,
 
 	line = list_last_entry(&history->lines, struct devcon_line, list);
 
-	ret = devcon_line_reserve(line, new_width, attr, age, line->width);
+	ret = devcon_history_unshare(line, attr, age);
 	if (ret < 0)
 		return NULL;
 
@@ -2176,6 +3191,14 @@ struct devcon_line *devcon_history_pop(struct devcon_history *history,
 	list_del_init(&line->list);
 	--history->n_lines;
 
+	while (history->n_marks > history->i_marks &&
+	       history->marks[history->n_marks - 1].seq >=
+						history->seq + history->n_lines)
+		--history->n_marks;
+
+	if (!history->n_lines)
+		history->i_marks = history->n_marks = 0;
+
 	return line;
 }
 
@@ -2183,45 +3206,563 @@ struct devcon_line *devcon_history_pop(struct devcon_history *history,
  * devcon_history_peek() - Return number of available history-lines
  * @history: history to work on
  * @max: maximum number of lines to look at
- * @reserve_width: width to reserve on the line
- * @attr: attributes to use for cell reservation
- * @age: age to use for cell reservation
  *
  * This returns the number of available lines in the history given as @history.
- * It returns at most @max. For each line that is looked at, the line is
- * verified to have at least @reserve_width cells. Valid cells are preserved,
- * new cells are initialized with @attr and @age. In case an allocation fails,
- * we bail out and return the number of lines that are valid so far.
- *
- * Usually, this function should be used before running a loop on
- * devcon_history_pop(). This function guarantees that devcon_history_pop()
- * (with the same arguments) will succeed at least the returned number of times.
+ * It returns at most @max. Lines are not touched, they are only prepared for
+ * their new width once they are retrieved via devcon_history_pop(). Hence,
+ * this is O(1), regardless of the size of the history. Note that
+ * devcon_history_pop() can still fail due to allocation errors.
  *
- * Returns: Number of valid lines that can be received via devcon_history_pop().
+ * Returns: Number of lines that can be received via devcon_history_pop().
  */
 unsigned int devcon_history_peek(struct devcon_history *history,
-				 unsigned int max,
-				 unsigned int reserve_width,
-				 const struct devcon_attr *attr,
-				 u64 age)
+				 unsigned int max)
+{
+	return min(max, history->n_lines);
+}
+
+/**
+ * devcon_history_find_time() - Find first history line pushed at a given time
+ * @history: history to search
+ * @time: wall-clock time in seconds since the epoch
+ *
+ * This does a binary search on the marks of @history for the first block of
+ * lines that was pushed at, or after, @time. Lines that are not covered by any
+ * mark are considered older than all others.
+ *
+ * Returns: Index of the line, counting from the oldest line, or the number of
+ *          lines in @history if all lines are older than @time.
+ */
+unsigned int devcon_history_find_time(struct devcon_history *history,
+				      time64_t time)
+{
+	unsigned int l = history->i_marks, r = history->n_marks, m;
+	u64 seq;
+
+	while (l < r) {
+		m = l + (r - l) / 2;
+		if (history->marks[m].time < time)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	if (l >= history->n_marks)
+		return history->n_lines;
+
+	seq = max(history->marks[l].seq, history->seq);
+	return seq - history->seq;
+}
+
+static void devcon_history_export_line(struct devcon_line *line,
+				       struct seq_file *m)
+{
+	const struct devcon_cell *cells = line->cells;
+	unsigned int i, n, skip = 0;
+	struct devcon_charbuf buf;
+	const u32 *ucs4;
+	char utf8[4];
+	size_t j, len;
+
+	if (line->body) {
+		n = line->body->fill;
+		cells = line->body->cells;
+	} else {
+		n = devcon_history_get_fill(line);
+	}
+
+	/* trailing blanks are not exported */
+	while (n > 0 && devcon_char_is_null(cells[n - 1].ch))
+		--n;
+
+	for (i = 0; i < n; ++i) {
+		if (devcon_char_is_null(cells[i].ch)) {
+			/* tail of a wide character */
+			if (skip)
+				--skip;
+			else
+				seq_putc(m, ' ');
+			continue;
+		}
+
+		skip = cells[i].cwidth > 1 ? cells[i].cwidth - 1 : 0;
+		ucs4 = devcon_char_resolve(cells[i].ch, &len, &buf);
+		for (j = 0; j < len; ++j)
+			seq_write(m, utf8, devcon_utf8_encode(utf8, ucs4[j]));
+	}
+
+	seq_putc(m, '\n');
+}
+
+/**
+ * devcon_history_export() - Export history as text
+ * @history: history to export
+ * @m: seq_file to write to
+ * @from: index of the first line to export, counting from the oldest line
+ *
+ * This writes all lines of @history, starting at line @from, as UTF-8 text
+ * to @m. Each line is prefixed with the time it was pushed at, in seconds
+ * since the epoch, or 0 if unknown. Combine it with
+ * devcon_history_find_time() to export everything since a given time.
+ */
+void devcon_history_export(struct devcon_history *history,
+			   struct seq_file *m,
+			   unsigned int from)
 {
+	unsigned int i = history->i_marks, num = 0;
 	struct devcon_line *line;
-	unsigned int num;
+	time64_t time;
+	u64 seq;
+
+	list_for_each_entry(line, &history->lines, list) {
+		if (num++ < from)
+			continue;
+
+		/* marks are sorted, so advance them together with the lines */
+		seq = history->seq + num - 1;
+		while (i + 1 < history->n_marks &&
+		       history->marks[i + 1].seq <= seq)
+			++i;
+
+		if (i < history->n_marks && history->marks[i].seq <= seq)
+			time = history->marks[i].time;
+		else
+			time = 0;
+
+		seq_printf(m, "%lld ", (long long)time);
+		devcon_history_export_line(line, m);
+	}
+}
+
+/*
+ * Serialization
+ * Pages and histories are serialized as a linear stream of lines, so saving
+ * and restoring is a single pass over the content. Each line is stored as its
+ * width, the number of stored cells and the attributes of the implied blanks
+ * beyond them, followed by the stored cells. Trailing blanks are never
+ * stored, and cell ages are not stored at all (restored content is always
+ * redrawn). Characters are stored as their UCS-4 sequence.
+ * The stream uses native byte-order and is only meant to be read back on the
+ * same machine.
+ */
+
+/**
+ * devcon_stream_write() - Write data to a stream
+ * @s: stream to write to
+ * @p: data to write
+ * @n: size of @p in bytes
+ *
+ * This appends @n bytes of @p to @s. If @s has no buffer, only the position
+ * is advanced, so the size of the serialized data can be calculated upfront.
+ */
+void devcon_stream_write(struct devcon_stream *s, const void *p, size_t n)
+{
+	if (s->data && !WARN_ON(s->pos > s->size || n > s->size - s->pos))
+		memcpy(s->data + s->pos, p, n);
+
+	s->pos += n;
+}
+
+/**
+ * devcon_stream_read() - Read data from a stream
+ * @s: stream to read from
+ * @p: buffer to read into
+ * @n: number of bytes to read
+ *
+ * Returns: 0 on success, -EINVAL if @s has less than @n bytes left.
+ */
+int devcon_stream_read(struct devcon_stream *s, void *p, size_t n)
+{
+	if (s->pos > s->size || n > s->size - s->pos)
+		return -EINVAL;
+
+	memcpy(p, s->data + s->pos, n);
+	s->pos += n;
+	return 0;
+}
+
+/*
+ * Colors are always stored as ccode plus three bytes, regardless of the
+ * configured color depth, and are quantized on load. This way, state can be
+ * handed over between modules built with different color depths.
+ */
+static void devcon_color_save(const struct devcon_color *color, u8 *buf)
+{
+	buf[0] = color->ccode;
+	buf[1] = 0;
+	buf[2] = 0;
+	buf[3] = 0;
+
+#if DEVCON_COLOR_DEPTH == 0
+	if (color->ccode == DEVCON_CCODE_RGB) {
+		buf[1] = color->red;
+		buf[2] = color->green;
+		buf[3] = color->blue;
+	}
+#endif
+#if DEVCON_COLOR_DEPTH != 16
+	if (color->ccode == DEVCON_CCODE_256)
+		buf[1] = color->c256;
+#endif
+}
+
+static void devcon_color_load(struct devcon_color *color, const u8 *buf)
+{
+	switch (buf[0]) {
+	case DEVCON_CCODE_256:
+		devcon_color_set_256(color, buf[1]);
+		break;
+	case DEVCON_CCODE_RGB:
+		devcon_color_set_rgb(color, buf[1], buf[2], buf[3]);
+		break;
+	default:
+		color->ccode = buf[0];
+		break;
+	}
+}
+
+/**
+ * devcon_attr_save() - Serialize attributes
+ * @attr: attributes to serialize
+ * @s: stream to write to
+ */
+void devcon_attr_save(const struct devcon_attr *attr, struct devcon_stream *s)
+{
+	u8 buf[9];
+
+	devcon_color_save(&attr->fg, buf);
+	devcon_color_save(&attr->bg, buf + 4);
+	buf[8] = attr->bold << 0 |
+		 attr->italic << 1 |
+		 attr->underline << 2 |
+		 attr->inverse << 3 |
+		 attr->protect << 4 |
+		 attr->blink << 5 |
+		 attr->hidden << 6;
+
+	devcon_stream_write(s, buf, sizeof(buf));
+}
+
+/**
+ * devcon_attr_load() - Restore serialized attributes
+ * @attr: attributes to restore into
+ * @s: stream to read from
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+int devcon_attr_load(struct devcon_attr *attr, struct devcon_stream *s)
+{
+	u8 buf[9];
 	int ret;
 
-	num = 0;
+	ret = devcon_stream_read(s, buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+
+	memset(attr, 0, sizeof(*attr));
+	devcon_color_load(&attr->fg, buf);
+	devcon_color_load(&attr->bg, buf + 4);
+	attr->bold = !!(buf[8] & (1 << 0));
+	attr->italic = !!(buf[8] & (1 << 1));
+	attr->underline = !!(buf[8] & (1 << 2));
+	attr->inverse = !!(buf[8] & (1 << 3));
+	attr->protect = !!(buf[8] & (1 << 4));
+	attr->blink = !!(buf[8] & (1 << 5));
+	attr->hidden = !!(buf[8] & (1 << 6));
 
-	list_for_each_entry_reverse(line, &history->lines, list) {
-		if (num >= max)
-			break;
+	return 0;
+}
+
+static void devcon_cell_save(const struct devcon_cell *cell,
+			     struct devcon_stream *s)
+{
+	struct devcon_charbuf buf;
+	const u32 *ch;
+	size_t n;
+	u8 head[2];
+
+	ch = devcon_char_resolve(cell->ch, &n, &buf);
+
+	/* allocated chars store their length in a u8, so this cannot clip */
+	head[0] = cell->cwidth;
+	head[1] = n;
 
-		ret = devcon_line_reserve(line, reserve_width, attr, age,
-					  line->width);
+	devcon_stream_write(s, head, sizeof(head));
+	devcon_attr_save(&cell->attr, s);
+	devcon_stream_write(s, ch, sizeof(*ch) * n);
+}
+
+static int devcon_cell_load(struct devcon_cell *cell,
+			    struct devcon_stream *s,
+			    u64 age)
+{
+	struct devcon_char ch = DEVCON_CHAR_NULL;
+	struct devcon_attr attr;
+	unsigned int i;
+	u8 head[2];
+	u32 ucs4;
+	int ret;
+
+	ret = devcon_stream_read(s, head, sizeof(head));
+	if (ret < 0)
+		return ret;
+
+	ret = devcon_attr_load(&attr, s);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < head[1]; ++i) {
+		ret = devcon_stream_read(s, &ucs4, sizeof(ucs4));
+		if (ret < 0) {
+			devcon_char_free(ch);
+			return ret;
+		}
+
+		if (i)
+			ch = devcon_char_merge(ch, ucs4);
+		else
+			ch = devcon_char_set(ch, ucs4);
+	}
+
+	devcon_cell_set(cell, ch, head[0], &attr, age);
+	return 0;
+}
+
+static void devcon_line_save(struct devcon_line *line, struct devcon_stream *s)
+{
+	const struct devcon_attr *erase = &line->erase;
+	const struct devcon_cell *cells = line->cells;
+	unsigned int i, width = line->width, n;
+
+	if (line->body) {
+		width = line->body->width;
+		n = line->body->fill;
+		cells = line->body->cells;
+		erase = &line->body->tail;
+	} else {
+		n = devcon_history_get_fill(line);
+	}
+
+	devcon_stream_write_u32(s, width);
+	devcon_stream_write_u32(s, n);
+	devcon_attr_save(erase, s);
+
+	for (i = 0; i < n; ++i)
+		devcon_cell_save(&cells[i], s);
+}
+
+/*
+ * Replace the content of @line with the next line in @s. All cells are set to
+ * @age. On failure, @line is valid but its content is undefined.
+ */
+static int devcon_line_load(struct devcon_line *line,
+			    struct devcon_stream *s,
+			    u64 age)
+{
+	struct devcon_attr erase;
+	u32 width, n, i;
+	int ret;
+
+	if (WARN_ON(line->body))
+		return -EINVAL;
+
+	ret = devcon_stream_read_u32(s, &width) ?:
+	      devcon_stream_read_u32(s, &n) ?:
+	      devcon_attr_load(&erase, s);
+	if (ret < 0)
+		return ret;
+	if (n > width)
+		return -EINVAL;
+
+	devcon_line_truncate(line, 0, &erase, age);
+	line->width = width;
+	line->age = age;
+
+	ret = devcon_line_materialize(line, n);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < n; ++i) {
+		ret = devcon_cell_load(&line->cells[i], s, age);
 		if (ret < 0)
-			break;
+			return ret;
+
+		devcon_line_mark(line, &line->cells[i].attr);
+		line->fill = i + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * devcon_page_save() - Serialize a page
+ * @page: page to serialize
+ * @s: stream to write to
+ *
+ * This writes the dimensions, the scroll-region and all visible lines of
+ * @page to @s. Use devcon_page_load() to restore it.
+ */
+void devcon_page_save(struct devcon_page *page, struct devcon_stream *s)
+{
+	unsigned int i;
+
+	devcon_stream_write_u32(s, page->width);
+	devcon_stream_write_u32(s, page->height);
+	devcon_stream_write_u32(s, page->scroll_idx);
+	devcon_stream_write_u32(s, page->scroll_num);
+	devcon_stream_write_u32(s, page->scroll_fill);
+
+	for (i = 0; i < page->height; ++i)
+		devcon_line_save(page->lines[i], s);
+}
+
+/**
+ * devcon_page_load() - Restore a serialized page
+ * @page: page to restore into
+ * @s: stream to read from
+ * @age: age to set on all cells
+ *
+ * This reads a page written by devcon_page_save() from @s and replaces the
+ * content of @page with it. The caller must have resized @page to the
+ * dimensions of the serialized page beforehand, otherwise this fails. If
+ * reading fails, the content of @page is undefined (but valid).
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+int devcon_page_load(struct devcon_page *page,
+		     struct devcon_stream *s,
+		     u64 age)
+{
+	u32 width, height, scroll_idx, scroll_num, scroll_fill, i;
+	int ret;
+
+	ret = devcon_stream_read_u32(s, &width) ?:
+	      devcon_stream_read_u32(s, &height) ?:
+	      devcon_stream_read_u32(s, &scroll_idx) ?:
+	      devcon_stream_read_u32(s, &scroll_num) ?:
+	      devcon_stream_read_u32(s, &scroll_fill);
+	if (ret < 0)
+		return ret;
 
-		++num;
+	if (width != page->width || height != page->height)
+		return -EINVAL;
+	if (scroll_idx > height || scroll_num > height - scroll_idx ||
+	    scroll_fill > scroll_num)
+		return -EINVAL;
+
+	for (i = 0; i < height; ++i) {
+		ret = devcon_line_load(page->lines[i], s, age);
+		if (ret < 0)
+			return ret;
+
+		devcon_line_set_width(page->lines[i], width);
+	}
+
+	page->scroll_idx = scroll_idx;
+	page->scroll_num = scroll_num;
+	page->scroll_fill = scroll_fill;
+	page->age = age;
+
+	return 0;
+}
+
+/**
+ * devcon_history_save() - Serialize a history
+ * @history: history to serialize
+ * @s: stream to write to
+ *
+ * This writes all lines of @history to @s, oldest first, followed by the
+ * marks that record when they were pushed. Use devcon_history_load() to
+ * restore them.
+ */
+void devcon_history_save(struct devcon_history *history,
+			 struct devcon_stream *s)
+{
+	struct devcon_history_mark *mark;
+	struct devcon_line *line;
+	unsigned int i;
+	u64 time;
+
+	devcon_stream_write_u32(s, history->n_lines);
+	list_for_each_entry(line, &history->lines, list)
+		devcon_line_save(line, s);
+
+	devcon_stream_write_u32(s, history->n_marks - history->i_marks);
+	for (i = history->i_marks; i < history->n_marks; ++i) {
+		mark = &history->marks[i];
+		time = mark->time;
+		devcon_stream_write_u32(s, max(mark->seq, history->seq) -
+					   history->seq);
+		devcon_stream_write(s, &time, sizeof(time));
 	}
+}
 
-	return num;
+/**
+ * devcon_history_load() - Restore a serialized history
+ * @history: history to restore into
+ * @s: stream to read from
+ * @age: age to set on all cells
+ *
+ * This clears @history and pushes all lines written by devcon_history_save()
+ * to it. The history limit of @history applies, so the oldest lines might be
+ * dropped. If reading fails, all lines restored so far are kept.
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+int devcon_history_load(struct devcon_history *history,
+			struct devcon_stream *s,
+			u64 age)
+{
+	struct devcon_line *line;
+	u32 n, i, offset;
+	u64 seq, time;
+	int ret;
+
+	devcon_history_clear(history);
+
+	ret = devcon_stream_read_u32(s, &n);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < n; ++i) {
+		ret = devcon_line_new(&line);
+		if (ret < 0)
+			return ret;
+
+		ret = devcon_line_load(line, s, age);
+		if (ret < 0) {
+			devcon_line_free(line);
+			return ret;
+		}
+
+		devcon_history_push_at(history, line, 0);
+	}
+
+	/*
+	 * Replace the marks set while pushing with the saved ones. The saved
+	 * offsets are relative to the oldest saved line, which might have been
+	 * dropped due to the history limit.
+	 */
+	seq = history->seq + history->n_lines - n;
+	history->i_marks = history->n_marks = 0;
+
+	ret = devcon_stream_read_u32(s, &n);
+	if (ret < 0)
+		return ret;
+
+	for ( ; n > 0; --n) {
+		ret = devcon_stream_read_u32(s, &offset) ?:
+		      devcon_stream_read(s, &time, sizeof(time));
+		if (ret < 0)
+			return ret;
+
+		if (history->n_lines)
+			devcon_history_mark(history, seq + offset, time);
+	}
+
+	while (history->n_marks - history->i_marks > 1 &&
+	       history->marks[history->i_marks + 1].seq <= history->seq)
+		++history->i_marks;
+
+	return 0;
 }
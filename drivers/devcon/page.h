@@ -10,9 +10,12 @@
 #ifndef __DEVCON_PAGE_H
 #define __DEVCON_PAGE_H
 
+#include <linux/gfp.h>
+#include <linux/hashtable.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
 #include <linux/string.h>
+#include <linux/time.h>
 
 struct devcon_attr;
 struct devcon_char;
@@ -20,8 +23,12 @@ struct devcon_charbuf;
 struct devcon_color;
 struct devcon_cell;
 struct devcon_history;
+struct devcon_history_mark;
 struct devcon_line;
+struct devcon_line_body;
 struct devcon_page;
+struct devcon_stream;
+struct seq_file;
 
 /*
  * Miscellaneous
@@ -30,7 +37,46 @@ struct devcon_page;
 
 #define DEVCON_AGE_NULL (0ULL)
 
+/*
+ * Allocation flags for any memory owned by a window. Most allocations happen
+ * while a task writes to the window, so they're charged to its memory cgroup.
+ */
+#ifdef __GFP_ACCOUNT
+#define DEVCON_GFP (GFP_KERNEL | __GFP_ACCOUNT)
+#else
+#define DEVCON_GFP GFP_KERNEL
+#endif
+
 int mk_wcwidth(int ucs4);
+void devcon_wcwidth_init(void);
+int devcon_wcwidth(u32 ucs4);
+
+/*
+ * Streams
+ * Pages and histories can be serialized into a flat buffer, so they survive a
+ * reload of the module. A devcon_stream is a cursor into such a buffer. If
+ * @data is NULL, writes only account for their size, so the buffer can be
+ * sized in a first pass. Reads beyond the end of the buffer fail.
+ */
+
+struct devcon_stream {
+	u8 *data;
+	size_t size;
+	size_t pos;
+};
+
+void devcon_stream_write(struct devcon_stream *s, const void *p, size_t n);
+int devcon_stream_read(struct devcon_stream *s, void *p, size_t n);
+
+static inline void devcon_stream_write_u32(struct devcon_stream *s, u32 v)
+{
+	devcon_stream_write(s, &v, sizeof(v));
+}
+
+static inline int devcon_stream_read_u32(struct devcon_stream *s, u32 *v)
+{
+	return devcon_stream_read(s, v, sizeof(*v));
+}
 
 /*
  * Characters
@@ -100,8 +146,22 @@ static inline bool devcon_char_equal(struct devcon_char a, struct devcon_char b)
  * The devcon_attr structure describes screen attributes of a terminal cell
  * that can be modified by the client application. Storage management of the
  * object is done by the caller, and the object can be copied by value.
+ * The color depth that is stored is selected at compile time. With
+ * CONFIG_DEVCON_COLOR_256, RGB colors are quantized to the 256-color palette,
+ * and with CONFIG_DEVCON_COLOR_16, all colors are quantized to the 16 ANSI
+ * colors. Colors must be set via devcon_color_set_256() and
+ * devcon_color_set_rgb(), which take care of the quantization. The smaller
+ * profiles shrink each cell from 32 to 24 bytes.
  */
 
+#if defined(CONFIG_DEVCON_COLOR_16)
+#  define DEVCON_COLOR_DEPTH 16
+#elif defined(CONFIG_DEVCON_COLOR_256)
+#  define DEVCON_COLOR_DEPTH 256
+#else
+#  define DEVCON_COLOR_DEPTH 0 /* truecolor */
+#endif
+
 enum {
 	/* special color-codes */
 	DEVCON_CCODE_DEFAULT,	/* default foreground/background color */
@@ -133,14 +193,18 @@ enum {
 
 struct devcon_color {
 	u8 ccode;
+#if DEVCON_COLOR_DEPTH != 16
 	union {
 		u8 c256;
+#  if DEVCON_COLOR_DEPTH == 0
 		struct {
 			u8 red;
 			u8 green;
 			u8 blue;
 		};
+#  endif
 	};
+#endif
 };
 
 struct devcon_attr {
@@ -148,17 +212,40 @@ struct devcon_attr {
 	struct devcon_color fg;		/* foreground color */
 	struct devcon_color bg;		/* background color */
 
-	unsigned int bold : 1;		/* bold font */
-	unsigned int italic : 1;	/* italic font */
-	unsigned int underline : 1;	/* underline text */
-	unsigned int inverse : 1;	/* inverse fg/bg */
-	unsigned int protect : 1;	/* protect from erase */
-	unsigned int blink : 1;		/* blink text */
-	unsigned int hidden : 1;	/* hidden */
+	/* u8 keeps the attributes byte-aligned, so cells pack tightly */
+	u8 bold : 1;			/* bold font */
+	u8 italic : 1;			/* italic font */
+	u8 underline : 1;		/* underline text */
+	u8 inverse : 1;			/* inverse fg/bg */
+	u8 protect : 1;			/* protect from erase */
+	u8 blink : 1;			/* blink text */
+	u8 hidden : 1;			/* hidden */
 };
 
+void devcon_color_set_256(struct devcon_color *color, u8 c256);
+void devcon_color_set_rgb(struct devcon_color *color, u8 r, u8 g, u8 b);
 void devcon_attr_to_argb32(const struct devcon_attr *attr,
 			   u32 *fg, u32 *bg, const u8 *palette);
+void devcon_attr_to_vga(const struct devcon_attr *attr, u8 *fg, u8 *bg);
+bool devcon_attr_equal(const struct devcon_attr *a,
+		       const struct devcon_attr *b);
+void devcon_attr_save(const struct devcon_attr *attr, struct devcon_stream *s);
+int devcon_attr_load(struct devcon_attr *attr, struct devcon_stream *s);
+
+/*
+ * Palettes
+ * A palette is an array of RGB triples for the 16 ANSI colors, followed by the
+ * default foreground and background colors. Colors of the 256-color palette
+ * above the first 16 entries are fixed and not part of it.
+ */
+
+#define DEVCON_PALETTE_FG 16
+#define DEVCON_PALETTE_BG 17
+#define DEVCON_PALETTE_N 18
+
+void devcon_palette_reset(u8 *palette, unsigned int entry);
+void devcon_palette_get_256(const u8 *palette, u8 c256, u8 *rgb);
+void devcon_palette_to_vga(const u8 *palette, u8 *vga);
 
 /*
  * Cells
@@ -170,7 +257,7 @@ struct devcon_cell {
 	struct devcon_char ch;		/* stored char or DEVCON_CHAR_NULL */
 	u64 age;			/* cell age or DEVCON_AGE_NULL */
 	struct devcon_attr attr;	/* cell attributes */
-	unsigned int cwidth;		/* cached wcwidth(ch) */
+	u8 cwidth;			/* cached wcwidth(ch) */
 };
 
 /*
@@ -183,6 +270,12 @@ struct devcon_cell {
  * cells, a fill-state which remembers the amount of blanks on the right side,
  * a separate age just for the line which can overwrite the age for all cells,
  * and some management data.
+ * Only the first @n_cells cells are allocated. All cells beyond, up to @width,
+ * are blanks with attributes @erase and age @erase_age. Use
+ * devcon_line_get_cell() to access cells of a line.
+ * @blink is set whenever a cell with the blink attribute is written to the
+ * line, and cleared once the line is erased as a whole, or a blink pass finds
+ * no blinking cells in it. Hence, lines without it never contain any.
  */
 
 struct devcon_line {
@@ -191,11 +284,35 @@ struct devcon_line {
 	unsigned int width;		/* visible width of line */
 	unsigned int n_cells;		/* # of allocated cells */
 	struct devcon_cell *cells;	/* cell-array */
+	struct devcon_attr erase;	/* attributes of unallocated cells */
+	u64 erase_age;			/* age of unallocated cells */
 
 	u64 age;			/* line age */
 	unsigned int fill;		/* # of valid cells; starting left */
+	bool blink;			/* might contain blinking cells */
+
+	struct devcon_line_body *body;	/* shared content of history lines */
 };
 
+/*
+ * Return cell @x of @line. If it is not allocated, @blank is initialized as
+ * implied blank and returned instead. The result must not be modified.
+ */
+static inline const struct devcon_cell *
+devcon_line_get_cell(const struct devcon_line *line,
+		     unsigned int x,
+		     struct devcon_cell *blank)
+{
+	if (x < line->n_cells)
+		return &line->cells[x];
+
+	blank->ch = DEVCON_CHAR_NULL;
+	blank->age = line->erase_age;
+	blank->attr = line->erase;
+	blank->cwidth = 0;
+	return blank;
+}
+
 /*
  * Pages
  * A page represents the 2D table containing all cells of a terminal. It stores
@@ -223,10 +340,19 @@ struct devcon_page {
 
 int devcon_page_new(struct devcon_page **out);
 struct devcon_page *devcon_page_free(struct devcon_page *page);
+size_t devcon_page_get_size(struct devcon_page *page);
+size_t devcon_page_release(struct devcon_page *page);
 
 struct devcon_cell *devcon_page_get_cell(struct devcon_page *page,
 					 unsigned int x,
 					 unsigned int y);
+void devcon_page_age_cell(struct devcon_page *page,
+			  unsigned int x,
+			  unsigned int y,
+			  u64 age);
+void devcon_page_age_palette(struct devcon_page *page, u32 mask, u64 age);
+bool devcon_page_has_blink(struct devcon_page *page);
+bool devcon_page_age_blink(struct devcon_page *page, u64 age);
 
 int devcon_page_reserve(struct devcon_page *page,
 			unsigned int cols,
@@ -276,6 +402,11 @@ void devcon_page_reset(struct devcon_page *page,
 		       const struct devcon_attr *attr,
 		       u64 age);
 
+void devcon_page_save(struct devcon_page *page, struct devcon_stream *s);
+int devcon_page_load(struct devcon_page *page,
+		     struct devcon_stream *s,
+		     u64 age);
+
 void devcon_page_set_scroll_region(struct devcon_page *page,
 				   unsigned int idx,
 				   unsigned int num);
@@ -310,12 +441,35 @@ void devcon_page_delete_lines(struct devcon_page *page,
  * history lines, besides pushing/poping. Note that history lines do not have a
  * guaranteed minimum length. Any kind of line might be stored there. Missing
  * cells should be cleared to the background color.
+ * The content of pushed lines is moved into bodies, which are shared between
+ * all history lines with identical content. A line owns either its cells, or
+ * a reference to a body, never both. Bodies are looked up via a hash of their
+ * content.
+ * Lines are not timestamped individually. Instead, the history keeps a sorted
+ * array of marks, each recording the wall-clock second of a block of
+ * consecutively pushed lines. A new mark is only added once the time changes,
+ * so bursts of output share a single mark. Lines are identified by a sequence
+ * number, which is the sequence number of the oldest line plus their offset.
  */
 
+#define DEVCON_HISTORY_HASH_BITS 8
+
+struct devcon_history_mark {
+	u64 seq;			/* sequence number of first line */
+	time64_t time;			/* push time of the block */
+};
+
 struct devcon_history {
 	struct list_head lines;
 	unsigned int n_lines;
 	unsigned int max_lines;
+	DECLARE_HASHTABLE(bodies, DEVCON_HISTORY_HASH_BITS);
+
+	u64 seq;			/* sequence number of oldest line */
+	struct devcon_history_mark *marks;
+	unsigned int i_marks;		/* index of first valid mark */
+	unsigned int n_marks;		/* index behind last valid mark */
+	unsigned int max_marks;		/* # of allocated marks */
 };
 
 int devcon_history_new(struct devcon_history **out);
@@ -323,6 +477,13 @@ struct devcon_history *devcon_history_free(struct devcon_history *history);
 
 void devcon_history_clear(struct devcon_history *history);
 void devcon_history_trim(struct devcon_history *history, unsigned int max);
+size_t devcon_history_get_size(struct devcon_history *history);
+size_t devcon_history_get_reclaimable(struct devcon_history *history,
+				      unsigned int floor);
+size_t devcon_history_shrink(struct devcon_history *history,
+			     unsigned int floor,
+			     size_t target,
+			     gfp_t gfp);
 void devcon_history_push(struct devcon_history *history,
 			 struct devcon_line *line);
 struct devcon_line *devcon_history_pop(struct devcon_history *history,
@@ -330,9 +491,16 @@ struct devcon_line *devcon_history_pop(struct devcon_history *history,
 				       const struct devcon_attr *attr,
 				       u64 age);
 unsigned int devcon_history_peek(struct devcon_history *history,
-				 unsigned int max,
-				 unsigned int reserve_width,
-				 const struct devcon_attr *attr,
-				 u64 age);
+				 unsigned int max);
+unsigned int devcon_history_find_time(struct devcon_history *history,
+				      time64_t time);
+void devcon_history_export(struct devcon_history *history,
+			   struct seq_file *m,
+			   unsigned int from);
+void devcon_history_save(struct devcon_history *history,
+			 struct devcon_stream *s);
+int devcon_history_load(struct devcon_history *history,
+			struct devcon_stream *s,
+			u64 age);
 
 #endif /* __DEVCON_PAGE_H */
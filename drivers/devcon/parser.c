@@ -11,6 +11,7 @@
 #include <linux/bitops.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include "page.h"
 #include "parser.h"
 
 /*
@@ -28,6 +29,8 @@ struct devcon_parser {
 	struct devcon_seq seq;
 	size_t st_alloc;
 	unsigned int state;
+	bool st_overflow : 1;
+	bool need_clear : 1;	/* @seq was dispatched on entering STATE_ESC */
 };
 
 /**
@@ -262,7 +265,7 @@ static unsigned int devcon_parse_host_control(const struct devcon_seq *seq)
 {
 	switch (seq->terminator) {
 	case 0x00: /* NUL */
-		return DEVCON_CMD_NULL;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_NULL);
 	case 0x05: /* ENQ */
 		return DEVCON_CMD_ENQ;
 	case 0x07: /* BEL */
@@ -284,9 +287,9 @@ static unsigned int devcon_parse_host_control(const struct devcon_seq *seq)
 	case 0x0f: /* SI */
 		return DEVCON_CMD_SI;
 	case 0x11: /* DC1 */
-		return DEVCON_CMD_DC1;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_DC1);
 	case 0x13: /* DC3 */
-		return DEVCON_CMD_DC3;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_DC3);
 	case 0x18: /* CAN */
 		/* this is already handled by the state-machine */
 		break;
@@ -314,9 +317,9 @@ static unsigned int devcon_parse_host_control(const struct devcon_seq *seq)
 		/* this is already handled by the state-machine */
 		break;
 	case 0x96: /* SPA */
-		return DEVCON_CMD_SPA;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_SPA);
 	case 0x97: /* EPA */
-		return DEVCON_CMD_EPA;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_EPA);
 	case 0x98: /* SOS */
 		/* this is already handled by the state-machine */
 		break;
@@ -326,7 +329,7 @@ static unsigned int devcon_parse_host_control(const struct devcon_seq *seq)
 		/* this is already handled by the state-machine */
 		break;
 	case 0x9c: /* ST */
-		return DEVCON_CMD_ST;
+		return DEVCON_CMD_LEGACY(DEVCON_CMD_ST);
 	case 0x9d: /* OSC */
 		/* this is already handled by the state-machine */
 		break;
@@ -366,6 +369,7 @@ static int devcon_charset_from_cmd(u32 raw, unsigned int flags, bool require_96)
 			{ .raw = '0', .flags = 0 },
 		[DEVCON_CHARSET_DEC_SUPPLEMENTAL] =
 			{ .raw = '5', .flags = DEVCON_SEQ_FLAG_PERCENT },
+#ifndef CONFIG_DEVCON_MINIMAL
 		[DEVCON_CHARSET_DEC_TECHNICAL] =
 			{ .raw = '>', .flags = 0 },
 		[DEVCON_CHARSET_CYRILLIC_DEC] =
@@ -408,11 +412,13 @@ static int devcon_charset_from_cmd(u32 raw, unsigned int flags, bool require_96)
 			{ .raw = '0', .flags = DEVCON_SEQ_FLAG_PERCENT },
 		[DEVCON_CHARSET_TURKISH_NRCS] =
 			{ .raw = '2', .flags = DEVCON_SEQ_FLAG_PERCENT },
+#endif
 
 		/* special charsets */
 		[DEVCON_CHARSET_USERPREF_SUPPLEMENTAL] =
 			{ .raw = '<', .flags = 0 },
 
+#ifndef CONFIG_DEVCON_MINIMAL
 		/* secondary choices */
 		[DEVCON_CHARSET_N + DEVCON_CHARSET_FINNISH_NRCS] =
 			{ .raw = 'C', .flags = 0 },
@@ -430,6 +436,7 @@ static int devcon_charset_from_cmd(u32 raw, unsigned int flags, bool require_96)
 		[DEVCON_CHARSET_N + DEVCON_CHARSET_N +
 		 DEVCON_CHARSET_NORWEGIAN_DANISH_NRCS] =
 			{ .raw = '6', .flags = 0 },
+#endif
 	};
 	size_t i, cs;
 
@@ -500,21 +507,21 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 	switch (seq->terminator) {
 	case '3':
 		if (flags == DEVCON_SEQ_FLAG_HASH) /* DECDHL top-half */
-			return DEVCON_CMD_DECDHL_TH;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECDHL_TH);
 		break;
 	case '4':
 		if (flags == DEVCON_SEQ_FLAG_HASH) /* DECDHL bottom-half */
-			return DEVCON_CMD_DECDHL_BH;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECDHL_BH);
 		break;
 	case '5':
 		if (flags == DEVCON_SEQ_FLAG_HASH) /* DECSWL */
-			return DEVCON_CMD_DECSWL;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSWL);
 		break;
 	case '6':
 		if (flags == 0) /* DECBI */
-			return DEVCON_CMD_DECBI;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECBI);
 		else if (flags == DEVCON_SEQ_FLAG_HASH) /* DECDWL */
-			return DEVCON_CMD_DECDWL;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECDWL);
 		break;
 	case '7':
 		if (flags == 0) /* DECSC */
@@ -524,15 +531,15 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 		if (flags == 0) /* DECRC */
 			return DEVCON_CMD_DECRC;
 		else if (flags == DEVCON_SEQ_FLAG_HASH) /* DECALN */
-			return DEVCON_CMD_DECALN;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECALN);
 		break;
 	case '9':
 		if (flags == 0) /* DECFI */
-			return DEVCON_CMD_DECFI;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECFI);
 		break;
 	case '<':
 		if (flags == 0) /* DECANM */
-			return DEVCON_CMD_DECANM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECANM);
 		break;
 	case '=':
 		if (flags == 0) /* DECKPAM */
@@ -545,7 +552,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 	case '@':
 		if (flags == DEVCON_SEQ_FLAG_PERCENT) {
 			/* Select default char-set */
-			return DEVCON_CMD_XTERM_SDCS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SDCS);
 		}
 		break;
 	case 'D':
@@ -558,7 +565,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 		break;
 	case 'F':
 		if (flags == 0) /* Cursor to lower-left corner of screen */
-			return DEVCON_CMD_XTERM_CLLHP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_CLLHP);
 		else if (flags == DEVCON_SEQ_FLAG_SPACE) /* S7C1T */
 			return DEVCON_CMD_S7C1T;
 		break;
@@ -567,7 +574,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 			return DEVCON_CMD_S8C1T;
 		} else if (flags == DEVCON_SEQ_FLAG_PERCENT) {
 			/* Select UTF-8 character set */
-			return DEVCON_CMD_XTERM_SUCS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SUCS);
 		}
 		break;
 	case 'H':
@@ -577,7 +584,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 	case 'L':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* Set ANSI conformance level 1 */
-			return DEVCON_CMD_XTERM_SACL1;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SACL1);
 		}
 		break;
 	case 'M':
@@ -585,7 +592,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 			return DEVCON_CMD_RI;
 		} else if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* Set ANSI conformance level 2 */
-			return DEVCON_CMD_XTERM_SACL2;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SACL2);
 		}
 		break;
 	case 'N':
@@ -593,7 +600,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 			return DEVCON_CMD_SS2;
 		} else if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* Set ANSI conformance level 3 */
-			return DEVCON_CMD_XTERM_SACL3;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SACL3);
 		}
 		break;
 	case 'O':
@@ -608,11 +615,11 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 		break;
 	case 'V':
 		if (flags == 0) /* SPA */
-			return DEVCON_CMD_SPA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_SPA);
 		break;
 	case 'W':
 		if (flags == 0) /* EPA */
-			return DEVCON_CMD_EPA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_EPA);
 		break;
 	case 'X':
 		if (flags == 0) { /* SOS */
@@ -632,7 +639,7 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 		break;
 	case '\\':
 		if (flags == 0) /* ST */
-			return DEVCON_CMD_ST;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_ST);
 		break;
 	case ']':
 		if (flags == 0) { /* OSC */
@@ -658,11 +665,11 @@ static unsigned int devcon_parse_host_escape(const struct devcon_seq *seq,
 		break;
 	case 'l':
 		if (flags == 0) /* Memory lock */
-			return DEVCON_CMD_XTERM_MLHP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_MLHP);
 		break;
 	case 'm':
 		if (flags == 0) /* Memory unlock */
-			return DEVCON_CMD_XTERM_MUHP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_MUHP);
 		break;
 	case 'n':
 		if (flags == 0) /* LS2 */
@@ -710,7 +717,7 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		break;
 	case 'b':
 		if (flags == 0) /* REP */
-			return DEVCON_CMD_REP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_REP);
 		break;
 	case 'C':
 		if (flags == 0) /* CUF */
@@ -722,7 +729,7 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		else if (flags == DEVCON_SEQ_FLAG_GT) /* DA2 */
 			return DEVCON_CMD_DA2;
 		else if (flags == DEVCON_SEQ_FLAG_EQUAL) /* DA3 */
-			return DEVCON_CMD_DA3;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DA3);
 		break;
 	case 'D':
 		if (flags == 0) /* CUB */
@@ -756,7 +763,7 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		if (flags == 0) /* TBC */
 			return DEVCON_CMD_TBC;
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECLFKC */
-			return DEVCON_CMD_DECLFKC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECLFKC);
 		break;
 	case 'H':
 		if (flags == 0) /* CUP */
@@ -774,9 +781,9 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		break;
 	case 'i':
 		if (flags == 0) /* MC ANSI */
-			return DEVCON_CMD_MC_ANSI;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_MC_ANSI);
 		else if (flags == DEVCON_SEQ_FLAG_WHAT) /* MC DEC */
-			return DEVCON_CMD_MC_DEC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_MC_DEC);
 		break;
 	case 'J':
 		if (flags == 0) /* ED */
@@ -808,70 +815,70 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		if (flags == 0) /* SGR */
 			return DEVCON_CMD_SGR;
 		else if (flags == DEVCON_SEQ_FLAG_GT) /* XTERM SMR */
-			return DEVCON_CMD_XTERM_SRV;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SRV);
 		break;
 	case 'n':
 		if (flags == 0) /* DSR ANSI */
-			return DEVCON_CMD_DSR_ANSI;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DSR_ANSI);
 		else if (flags == DEVCON_SEQ_FLAG_GT) /* XTERM RMR */
-			return DEVCON_CMD_XTERM_RRV;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_RRV);
 		else if (flags == DEVCON_SEQ_FLAG_WHAT) /* DSR DEC */
-			return DEVCON_CMD_DSR_DEC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DSR_DEC);
 		break;
 	case 'P':
 		if (flags == 0) /* DCH */
 			return DEVCON_CMD_DCH;
 		else if (flags == DEVCON_SEQ_FLAG_SPACE) /* PPA */
-			return DEVCON_CMD_PPA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_PPA);
 		break;
 	case 'p':
 		if (flags == 0) /* DECSSL */
-			return DEVCON_CMD_DECSSL;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSSL);
 		else if (flags == DEVCON_SEQ_FLAG_SPACE) /* DECSSCLS */
-			return DEVCON_CMD_DECSSCLS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSSCLS);
 		else if (flags == DEVCON_SEQ_FLAG_BANG) /* DECSTR */
 			return DEVCON_CMD_DECSTR;
 		else if (flags == DEVCON_SEQ_FLAG_DQUOTE) /* DECSCL */
 			return DEVCON_CMD_DECSCL;
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECRQM-ANSI */
-			return DEVCON_CMD_DECRQM_ANSI;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQM_ANSI);
 		else if (flags == (DEVCON_SEQ_FLAG_CASH |
 				   DEVCON_SEQ_FLAG_WHAT)) /* DECRQM-DEC */
-			return DEVCON_CMD_DECRQM_DEC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQM_DEC);
 		else if (flags == DEVCON_SEQ_FLAG_PCLOSE) /* DECSDPT */
-			return DEVCON_CMD_DECSDPT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSDPT);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECSPPCS */
-			return DEVCON_CMD_DECSPPCS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSPPCS);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECSR */
-			return DEVCON_CMD_DECSR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSR);
 		else if (flags == DEVCON_SEQ_FLAG_COMMA) /* DECLTOD */
-			return DEVCON_CMD_DECLTOD;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECLTOD);
 		else if (flags == DEVCON_SEQ_FLAG_GT) /* XTERM SPM */
-			return DEVCON_CMD_XTERM_SPM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SPM);
 		break;
 	case 'Q':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) /* PPR */
-			return DEVCON_CMD_PPR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_PPR);
 		break;
 	case 'q':
 		if (flags == 0) /* DECLL */
-			return DEVCON_CMD_DECLL;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECLL);
 		else if (flags == DEVCON_SEQ_FLAG_SPACE) /* DECSCUSR */
 			return DEVCON_CMD_DECSCUSR;
 		else if (flags == DEVCON_SEQ_FLAG_DQUOTE) /* DECSCA */
 			return DEVCON_CMD_DECSCA;
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECSDDT */
-			return DEVCON_CMD_DECSDDT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSDDT);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECSRC */
-			return DEVCON_CMD_DECSR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSR);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECELF */
-			return DEVCON_CMD_DECELF;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECELF);
 		else if (flags == DEVCON_SEQ_FLAG_COMMA) /* DECTID */
-			return DEVCON_CMD_DECTID;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECTID);
 		break;
 	case 'R':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) /* PPB */
-			return DEVCON_CMD_PPB;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_PPB);
 		break;
 	case 'r':
 		if (flags == 0) {
@@ -879,16 +886,16 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			return DEVCON_CMD_DECSTBM;
 		} else if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* DECSKCV */
-			return DEVCON_CMD_DECSKCV;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSKCV);
 		} else if (flags == DEVCON_SEQ_FLAG_CASH) {
 			/* DECCARA */
-			return DEVCON_CMD_DECCARA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECCARA);
 		} else if (flags == DEVCON_SEQ_FLAG_MULT) {
 			/* DECSCS */
-			return DEVCON_CMD_DECSCS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSCS);
 		} else if (flags == DEVCON_SEQ_FLAG_PLUS) {
 			/* DECSMKR */
-			return DEVCON_CMD_DECSMKR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSMKR);
 		} else if (flags == DEVCON_SEQ_FLAG_WHAT) {
 			/*
 			 * There's a conflict between DECPCTERM and XTERM-RPM.
@@ -897,16 +904,16 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			 * match.
 			 */
 			if (seq->n_args <= 1) /* XTERM RPM */
-				return DEVCON_CMD_XTERM_RPM;
+				return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_RPM);
 			else if (seq->n_args >= 2) /* DECPCTERM */
-				return DEVCON_CMD_DECPCTERM;
+				return DEVCON_CMD_LEGACY(DEVCON_CMD_DECPCTERM);
 		}
 		break;
 	case 'S':
 		if (flags == 0) /* SU */
 			return DEVCON_CMD_SU;
 		else if (flags == DEVCON_SEQ_FLAG_WHAT) /* XTERM SGFX */
-			return DEVCON_CMD_XTERM_SGFX;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SGFX);
 		break;
 	case 's':
 		if (flags == 0) {
@@ -915,16 +922,16 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			 * cannot be resolved without knowing the state of
 			 * DECLRMM. We leave that decision up to the caller.
 			 */
-			return DEVCON_CMD_DECSLRM_OR_SC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSLRM_OR_SC);
 		} else if (flags == DEVCON_SEQ_FLAG_CASH) {
 			/* DECSPRTT */
-			return DEVCON_CMD_DECSPRTT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSPRTT);
 		} else if (flags == DEVCON_SEQ_FLAG_MULT) {
 			/* DECSFC */
-			return DEVCON_CMD_DECSFC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSFC);
 		} else if (flags == DEVCON_SEQ_FLAG_WHAT) {
 			/* XTERM SPM */
-			return DEVCON_CMD_XTERM_SPM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_SPM);
 		}
 		break;
 	case 'T':
@@ -938,14 +945,14 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			 */
 			if (seq->n_args >= 5) {
 				/* XTERM IHMT */
-				return DEVCON_CMD_XTERM_IHMT;
+				return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_IHMT);
 			} else if (seq->n_args < 5) {
 				/* SD */
 				return DEVCON_CMD_SD;
 			}
 		} else if (flags == DEVCON_SEQ_FLAG_GT) {
 			/* XTERM RTM */
-			return DEVCON_CMD_XTERM_RTM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_RTM);
 		}
 		break;
 	case 't':
@@ -958,24 +965,25 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			 * TODO: Figure out how to resolve that conflict and
 			 *       return DEVCON_CMD_DECSLPP if possible.
 			 */
-			return DEVCON_CMD_XTERM_WM; /* XTERM WM */
+			/* XTERM WM */
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_WM);
 		} else if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* DECSWBV */
-			return DEVCON_CMD_DECSWBV;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSWBV);
 		} else if (flags == DEVCON_SEQ_FLAG_DQUOTE) {
 			/* DECSRFR */
-			return DEVCON_CMD_DECSRFR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSRFR);
 		} else if (flags == DEVCON_SEQ_FLAG_CASH) {
 			/* DECRARA */
-			return DEVCON_CMD_DECRARA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRARA);
 		} else if (flags == DEVCON_SEQ_FLAG_GT) {
 			/* XTERM STM */
-			return DEVCON_CMD_XTERM_STM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_XTERM_STM);
 		}
 		break;
 	case 'U':
 		if (flags == 0) /* NP */
-			return DEVCON_CMD_NP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_NP);
 		break;
 	case 'u':
 		if (flags == 0) {
@@ -983,37 +991,37 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 			return DEVCON_CMD_RC;
 		} else if (flags == DEVCON_SEQ_FLAG_SPACE) {
 			/* DECSMBV */
-			return DEVCON_CMD_DECSMBV;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSMBV);
 		} else if (flags == DEVCON_SEQ_FLAG_DQUOTE) {
 			/* DECSTRL */
-			return DEVCON_CMD_DECSTRL;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSTRL);
 		} else if (flags == DEVCON_SEQ_FLAG_WHAT) {
 			/* DECRQUPSS */
-			return DEVCON_CMD_DECRQUPSS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQUPSS);
 		} else if (seq->args[0] == 1 && flags == DEVCON_SEQ_FLAG_CASH) {
 			/* DECRQTSR */
-			return DEVCON_CMD_DECRQTSR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQTSR);
 		} else if (flags == DEVCON_SEQ_FLAG_MULT) {
 			/* DECSCP */
-			return DEVCON_CMD_DECSCP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSCP);
 		} else if (flags == DEVCON_SEQ_FLAG_COMMA) {
 			/* DECRQKT */
-			return DEVCON_CMD_DECRQKT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQKT);
 		}
 		break;
 	case 'V':
 		if (flags == 0) /* PP */
-			return DEVCON_CMD_PP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_PP);
 		break;
 	case 'v':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) /* DECSLCK */
-			return DEVCON_CMD_DECSLCK;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSLCK);
 		else if (flags == DEVCON_SEQ_FLAG_DQUOTE) /* DECRQDE */
-			return DEVCON_CMD_DECRQDE;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQDE);
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECCRA */
-			return DEVCON_CMD_DECCRA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECCRA);
 		else if (flags == DEVCON_SEQ_FLAG_COMMA) /* DECRPKT */
-			return DEVCON_CMD_DECRPKT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRPKT);
 		break;
 	case 'W':
 		if (seq->args[0] == 5 && flags == DEVCON_SEQ_FLAG_WHAT) {
@@ -1023,11 +1031,11 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		break;
 	case 'w':
 		if (flags == DEVCON_SEQ_FLAG_CASH) /* DECRQPSR */
-			return DEVCON_CMD_DECRQPSR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQPSR);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECEFR */
-			return DEVCON_CMD_DECEFR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECEFR);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECSPP */
-			return DEVCON_CMD_DECSPP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSPP);
 		break;
 	case 'X':
 		if (flags == 0) /* ECH */
@@ -1037,19 +1045,19 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		if (flags == 0) /* DECREQTPARM */
 			return DEVCON_CMD_DECREQTPARM;
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECFRA */
-			return DEVCON_CMD_DECFRA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECFRA);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECSACE */
-			return DEVCON_CMD_DECSACE;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSACE);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECRQPKFM */
-			return DEVCON_CMD_DECRQPKFM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQPKFM);
 		break;
 	case 'y':
 		if (flags == 0) /* DECTST */
-			return DEVCON_CMD_DECTST;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECTST);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECRQCRA */
-			return DEVCON_CMD_DECRQCRA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQCRA);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECPKFMR */
-			return DEVCON_CMD_DECPKFMR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECPKFMR);
 		break;
 	case 'Z':
 		if (flags == 0) /* CBT */
@@ -1057,13 +1065,13 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		break;
 	case 'z':
 		if (flags == DEVCON_SEQ_FLAG_CASH) /* DECERA */
-			return DEVCON_CMD_DECERA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECERA);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECELR */
-			return DEVCON_CMD_DECELR;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECELR);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECINVM */
-			return DEVCON_CMD_DECINVM;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECINVM);
 		else if (flags == DEVCON_SEQ_FLAG_PLUS) /* DECPKA */
-			return DEVCON_CMD_DECPKA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECPKA);
 		break;
 	case '@':
 		if (flags == 0) /* ICH */
@@ -1075,33 +1083,33 @@ static unsigned int devcon_parse_host_csi(const struct devcon_seq *seq)
 		break;
 	case '{':
 		if (flags == DEVCON_SEQ_FLAG_CASH) /* DECSERA */
-			return DEVCON_CMD_DECSERA;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSERA);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECSLE */
-			return DEVCON_CMD_DECSLE;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSLE);
 		break;
 	case '|':
 		if (flags == DEVCON_SEQ_FLAG_CASH) /* DECSCPP */
-			return DEVCON_CMD_DECSCPP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSCPP);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECRQLP */
-			return DEVCON_CMD_DECRQLP;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECRQLP);
 		else if (flags == DEVCON_SEQ_FLAG_MULT) /* DECSNLS */
-			return DEVCON_CMD_DECSNLS;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSNLS);
 		break;
 	case '}':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) /* DECKBD */
-			return DEVCON_CMD_DECKBD;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECKBD);
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECSASD */
-			return DEVCON_CMD_DECSASD;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSASD);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECIC */
-			return DEVCON_CMD_DECIC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECIC);
 		break;
 	case '~':
 		if (flags == DEVCON_SEQ_FLAG_SPACE) /* DECTME */
-			return DEVCON_CMD_DECTME;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECTME);
 		else if (flags == DEVCON_SEQ_FLAG_CASH) /* DECSSDT */
-			return DEVCON_CMD_DECSSDT;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECSSDT);
 		else if (flags == DEVCON_SEQ_FLAG_SQUOTE) /* DECDC */
-			return DEVCON_CMD_DECDC;
+			return DEVCON_CMD_LEGACY(DEVCON_CMD_DECDC);
 		break;
 	}
 
@@ -1168,12 +1176,12 @@ int devcon_parser_new(struct devcon_parser **out)
 {
 	struct devcon_parser *parser;
 
-	parser = kzalloc(sizeof(*parser), GFP_KERNEL);
+	parser = kzalloc(sizeof(*parser), DEVCON_GFP);
 	if (!parser)
 		return -ENOMEM;
 
 	parser->st_alloc = 64;
-	parser->seq.st = kzalloc(parser->st_alloc + 1, GFP_KERNEL);
+	parser->seq.st = kzalloc(parser->st_alloc + 1, DEVCON_GFP);
 	if (!parser->seq.st) {
 		kfree(parser);
 		return -ENOMEM;
@@ -1213,6 +1221,7 @@ static inline void parser_clear(struct devcon_parser *parser)
 
 	parser->seq.n_st = 0;
 	parser->seq.st[0] = 0;
+	parser->st_overflow = false;
 }
 
 static int parser_ignore(struct devcon_parser *parser, u32 raw)
@@ -1329,6 +1338,52 @@ static int parser_csi(struct devcon_parser *parser, u32 raw)
 	return parser->seq.type;
 }
 
+static void parser_osc_collect(struct devcon_parser *parser, u32 raw)
+{
+	size_t n;
+	char *t;
+
+	/*
+	 * None of the supported commands use anything but ASCII, so everything
+	 * else is dropped. The buffer is grown on demand, but strings longer
+	 * than DEVCON_PARSER_ST_MAX are discarded as a whole, rather than
+	 * dispatched truncated.
+	 */
+
+	if (raw >= 0x80 || parser->st_overflow)
+		return;
+
+	if (parser->seq.n_st >= parser->st_alloc) {
+		n = min_t(size_t, parser->st_alloc * 2, DEVCON_PARSER_ST_MAX);
+		t = NULL;
+		if (n > parser->st_alloc)
+			t = krealloc(parser->seq.st, n + 1, DEVCON_GFP);
+		if (!t) {
+			parser->st_overflow = true;
+			return;
+		}
+
+		parser->seq.st = t;
+		parser->st_alloc = n;
+	}
+
+	parser->seq.st[parser->seq.n_st++] = raw;
+	parser->seq.st[parser->seq.n_st] = 0;
+}
+
+static int parser_osc(struct devcon_parser *parser, u32 raw)
+{
+	if (parser->st_overflow)
+		return DEVCON_SEQ_NONE;
+
+	parser->seq.type = DEVCON_SEQ_OSC;
+	parser->seq.command = DEVCON_CMD_OSC;
+	parser->seq.terminator = raw;
+	parser->seq.charset = DEVCON_CHARSET_NONE;
+
+	return parser->seq.type;
+}
+
 /* perform state transition and dispatch related actions */
 static int parser_transition(struct devcon_parser *parser,
 			     u32 raw,
@@ -1376,14 +1431,13 @@ static int parser_transition(struct devcon_parser *parser,
 		/* not implemented */
 		return DEVCON_SEQ_NONE;
 	case ACTION_OSC_COLLECT:
-		/* not implemented */
+		parser_osc_collect(parser, raw);
 		return DEVCON_SEQ_NONE;
 	case ACTION_OSC_CONSUME:
 		/* not implemented */
 		return DEVCON_SEQ_NONE;
 	case ACTION_OSC_DISPATCH:
-		/* not implemented */
-		return DEVCON_SEQ_NONE;
+		return parser_osc(parser, raw);
 	default:
 		WARN(1, "invalid vte-parser action");
 		return DEVCON_SEQ_NONE;
@@ -1738,6 +1792,16 @@ int devcon_parser_feed(struct devcon_parser *parser,
 	 *    be ignored/executed depending on the sequence.
 	 */
 
+	/*
+	 * An ESC that terminates an OSC string dispatches it, instead of
+	 * clearing the sequence it starts. This is caught up on here, once the
+	 * caller is done with the dispatched sequence.
+	 */
+	if (parser->need_clear) {
+		parser->need_clear = false;
+		parser_clear(parser);
+	}
+
 	switch (raw) {
 	case 0x18:		/* CAN */
 		ret = parser_transition(parser, raw,
@@ -1754,8 +1818,14 @@ int devcon_parser_feed(struct devcon_parser *parser,
 					STATE_GROUND, ACTION_EXECUTE);
 		break;
 	case 0x1b:		/* ESC */
-		ret = parser_transition(parser, raw,
-					STATE_ESC, ACTION_CLEAR);
+		/* the 7bit ST is "ESC \", so ESC also terminates OSC strings */
+		if (parser->state == STATE_OSC_STRING) {
+			ret = parser_transition(parser, raw,
+						STATE_ESC, ACTION_OSC_DISPATCH);
+			parser->need_clear = true;
+		} else
+			ret = parser_transition(parser, raw,
+						STATE_ESC, ACTION_CLEAR);
 		break;
 	case 0x98:		/* SOS */
 	case 0x9e:		/* PM */
@@ -1787,3 +1857,77 @@ int devcon_parser_feed(struct devcon_parser *parser,
 
 	return ret;
 }
+
+#ifdef CONFIG_DEVCON_VERIFY
+
+/* feed @str and return the last sequence dispatched, or NULL */
+static const struct devcon_seq *parser_selftest_feed(struct devcon_parser *p,
+						     const char *str)
+{
+	const struct devcon_seq *seq, *last = NULL;
+
+	for ( ; *str; ++str)
+		if (devcon_parser_feed(p, &seq, *str) > 0)
+			last = seq;
+
+	return last;
+}
+
+/**
+ * devcon_parser_selftest() - Test sequences that are hard to hit otherwise
+ *
+ * The shadow screen of CONFIG_DEVCON_VERIFY uses the same parser as the screen
+ * it verifies, so parser bugs go unnoticed by it. This feeds known sequences
+ * through a fresh parser, and compares the dispatched sequences against the
+ * expected ones. It is run once at module initialization.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int devcon_parser_selftest(void)
+{
+	const struct devcon_seq *seq;
+	struct devcon_parser *p;
+	const char *failed = NULL;
+	int r;
+
+	r = devcon_parser_new(&p);
+	if (r < 0)
+		return r;
+
+	/* OSC terminated by "ESC \" followed by an ESC sequence */
+	seq = parser_selftest_feed(p, "\e]4;1;?\e");
+	if (!seq || seq->type != DEVCON_SEQ_OSC || seq->n_st != 5 ||
+	    strcmp(seq->st, "4;1;?"))
+		failed = "OSC dispatch";
+
+	seq = parser_selftest_feed(p, "\\");
+	if (!failed && (!seq || seq->type != DEVCON_SEQ_ESCAPE ||
+			seq->intermediates || seq->n_st))
+		failed = "ST after OSC";
+
+	seq = parser_selftest_feed(p, "\e(0");
+	if (!failed && (!seq || seq->command != DEVCON_CMD_SCS ||
+			seq->intermediates != DEVCON_SEQ_FLAG_POPEN ||
+			seq->charset != DEVCON_CHARSET_DEC_SPECIAL_GRAPHIC ||
+			seq->n_st || seq->terminator != '0'))
+		failed = "ESC sequence after ST";
+
+	/* OSC terminated by an ESC that starts the next sequence right away */
+	parser_selftest_feed(p, "\e]10;?");
+	seq = parser_selftest_feed(p, "\e(0");
+	if (!failed && (!seq || seq->command != DEVCON_CMD_SCS ||
+			seq->intermediates != DEVCON_SEQ_FLAG_POPEN ||
+			seq->n_st))
+		failed = "ESC sequence after OSC";
+
+	devcon_parser_free(p);
+
+	if (failed) {
+		pr_err("parser self-test failed: %s\n", failed);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+#endif /* CONFIG_DEVCON_VERIFY */
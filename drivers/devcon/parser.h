@@ -235,6 +235,7 @@ enum {
 	DEVCON_CMD_NEL,			/* next-line */
 	DEVCON_CMD_NP,			/* next-page */
 	DEVCON_CMD_NULL,		/* null */
+	DEVCON_CMD_OSC,			/* operating-system-command */
 	DEVCON_CMD_PP,			/* preceding-page */
 	DEVCON_CMD_PPA,			/* page-position-absolute */
 	DEVCON_CMD_PPB,			/* page-position-backward */
@@ -285,6 +286,18 @@ enum {
 	DEVCON_CMD_N,
 };
 
+/*
+ * Commands that are recognized, but have no effect on the screen, are wrapped
+ * in DEVCON_CMD_LEGACY() by the parser. With CONFIG_DEVCON_MINIMAL, they are
+ * reported as DEVCON_CMD_NONE instead, so their detection is compiled out of
+ * the parser. This also covers VT52 mode (DECANM), which is not supported.
+ */
+#ifdef CONFIG_DEVCON_MINIMAL
+#  define DEVCON_CMD_LEGACY(_cmd) DEVCON_CMD_NONE
+#else
+#  define DEVCON_CMD_LEGACY(_cmd) (_cmd)
+#endif
+
 enum {
 	/*
 	 * Charsets: DEC marks charsets according to "Digital Equ. Corp.".
@@ -358,4 +371,13 @@ int devcon_parser_feed(struct devcon_parser *parser,
 		       const struct devcon_seq **seq_out,
 		       u32 raw);
 
+#ifdef CONFIG_DEVCON_VERIFY
+int devcon_parser_selftest(void);
+#else
+static inline int devcon_parser_selftest(void)
+{
+	return 0;
+}
+#endif
+
 #endif /* __DEVCON_PARSER_H */
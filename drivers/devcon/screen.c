@@ -7,6 +7,8 @@
  * your option) any later version.
  */
 
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/stringify.h>
@@ -46,6 +48,9 @@
 #include "parser.h"
 #include "screen.h"
 
+/* number of blink phases the cursor blinks for after the last output */
+#define SCREEN_CURSOR_BLINK_MAX 20
+
 enum {
 	/* 7bit mode (default: on) */
 	DEVCON_FLAG_7BIT_MODE		= (1U << 0),
@@ -63,6 +68,12 @@ enum {
 	DEVCON_FLAG_CURSOR_KEYS		= (1U << 6),
 };
 
+enum {
+	DEVCON_CURSOR_BLOCK,
+	DEVCON_CURSOR_UNDERLINE,
+	DEVCON_CURSOR_BAR,
+};
+
 enum {
 	DEVCON_CONFORMANCE_LEVEL_VT52,
 	DEVCON_CONFORMANCE_LEVEL_VT100,
@@ -105,6 +116,7 @@ struct devcon_screen {
 
 	unsigned int flags;
 	unsigned int conformance_level;
+	unsigned int cursor_style;
 	struct devcon_attr default_attr;
 
 	devcon_charset *g0;
@@ -113,22 +125,90 @@ struct devcon_screen {
 	devcon_charset *g3;
 
 	char *answerback;
+	u8 palette[DEVCON_PALETTE_N * 3];
 
 	struct devcon_state state;
 	struct devcon_state saved;
 	struct devcon_state saved_alt;
+
+	unsigned int cursor_blinks;	/* blink phases since last output */
+	bool cursor_blink : 1;		/* cursor blinks */
+	bool blink_off : 1;		/* blinking content currently hidden */
+	bool alt_released : 1;		/* page_alt has no lines allocated */
+
+#ifdef CONFIG_DEVCON_VERIFY
+	struct devcon_screen *shadow;	/* reference screen, fed bytewise */
+	u64 verify_offset;		/* input bytes fed so far */
+	struct screen_verify_cell *verify_grid;	/* last rendered frame */
+	unsigned int verify_width;
+	unsigned int verify_height;
+	u64 verify_age;			/* age of verify_grid */
+	bool verify_failed : 1;		/* divergence was reported */
+#endif
 };
 
-int devcon_screen_new(struct devcon_screen **out,
+/*
+ * Verification
+ * With CONFIG_DEVCON_VERIFY, each screen carries a shadow screen. All input is
+ * fed into the shadow one byte at a time, and both screens are compared after
+ * each chunk. Furthermore, each damage-limited render is compared against a
+ * full render of the same screen. The first divergence is reported. The
+ * helpers are implemented at the end of this file.
+ */
+
+#ifdef CONFIG_DEVCON_VERIFY
+static int screen_verify_new(struct devcon_screen *screen);
+static void screen_verify_free(struct devcon_screen *screen);
+static void screen_verify_feed(struct devcon_screen *screen,
+			       const u8 *in,
+			       size_t size);
+static void screen_verify_resize(struct devcon_screen *screen,
+				 unsigned int x,
+				 unsigned int y);
+static void screen_verify_shrink(struct devcon_screen *screen,
+				 unsigned int floor,
+				 size_t target,
+				 gfp_t gfp);
+static void screen_verify_hard_reset(struct devcon_screen *screen);
+static void screen_verify_load(struct devcon_screen *screen,
+			       const struct devcon_stream *s,
+			       size_t pos);
+#else
+static inline int screen_verify_new(struct devcon_screen *screen)
+{
+	return 0;
+}
+
+static inline void screen_verify_free(struct devcon_screen *screen) { }
+static inline void screen_verify_feed(struct devcon_screen *screen,
+				      const u8 *in,
+				      size_t size) { }
+static inline void screen_verify_resize(struct devcon_screen *screen,
+					unsigned int x,
+					unsigned int y) { }
+static inline void screen_verify_shrink(struct devcon_screen *screen,
+					unsigned int floor,
+					size_t target,
+					gfp_t gfp) { }
+static inline void screen_verify_hard_reset(struct devcon_screen *screen) { }
+static inline void screen_verify_load(struct devcon_screen *screen,
+				      const struct devcon_stream *s,
+				      size_t pos) { }
+#endif
+
+static void screen_hard_reset(struct devcon_screen *screen);
+
+static int screen_new(struct devcon_screen **out,
 		      devcon_screen_write_fn write_fn,
 		      void *write_fn_data,
 		      devcon_screen_cmd_fn cmd_fn,
 		      void *cmd_fn_data)
 {
 	struct devcon_screen *screen;
+	unsigned int i;
 	int ret;
 
-	screen = kzalloc(sizeof(*screen), GFP_KERNEL);
+	screen = kzalloc(sizeof(*screen), DEVCON_GFP);
 	if (!screen)
 		return -ENOMEM;
 
@@ -139,6 +219,8 @@ int devcon_screen_new(struct devcon_screen **out,
 	screen->cmd_fn_data = cmd_fn_data;
 	screen->flags = DEVCON_FLAG_7BIT_MODE;
 	screen->conformance_level = DEVCON_CONFORMANCE_LEVEL_VT400;
+	screen->cursor_style = DEVCON_CURSOR_BLOCK;
+	screen->cursor_blink = true;
 	screen->g0 = &devcon_unicode_lower;
 	screen->g1 = &devcon_unicode_upper;
 	screen->g2 = &devcon_unicode_lower;
@@ -148,6 +230,9 @@ int devcon_screen_new(struct devcon_screen **out,
 	screen->saved = screen->state;
 	screen->saved_alt = screen->saved;
 
+	for (i = 0; i < DEVCON_PALETTE_N; ++i)
+		devcon_palette_reset(screen->palette, i);
+
 	ret = devcon_page_new(&screen->page_main);
 	if (ret < 0)
 		goto error;
@@ -175,11 +260,36 @@ error:
 	return ret;
 }
 
+int devcon_screen_new(struct devcon_screen **out,
+		      devcon_screen_write_fn write_fn,
+		      void *write_fn_data,
+		      devcon_screen_cmd_fn cmd_fn,
+		      void *cmd_fn_data)
+{
+	struct devcon_screen *screen;
+	int ret;
+
+	ret = screen_new(&screen, write_fn, write_fn_data,
+			 cmd_fn, cmd_fn_data);
+	if (ret < 0)
+		return ret;
+
+	ret = screen_verify_new(screen);
+	if (ret < 0) {
+		devcon_screen_free(screen);
+		return ret;
+	}
+
+	*out = screen;
+	return 0;
+}
+
 struct devcon_screen *devcon_screen_free(struct devcon_screen *screen)
 {
 	if (!screen)
 		return NULL;
 
+	screen_verify_free(screen);
 	kfree(screen->answerback);
 	kfree(screen->tabs);
 	devcon_history_free(screen->history_main);
@@ -291,15 +401,20 @@ static bool screen_tab_is_set(struct devcon_screen *screen, unsigned int pos)
 	return screen->tabs[pos / 8] & (1 << (pos % 8));
 }
 
-static inline void screen_age_cursor(struct devcon_screen *screen)
+/* return true if the cursor is visible and currently blinks */
+static bool screen_cursor_blinks(struct devcon_screen *screen)
 {
-	struct devcon_cell *cell;
+	return screen->cursor_blink &&
+	       !(screen->flags & DEVCON_FLAG_HIDE_CURSOR) &&
+	       screen->cursor_blinks < SCREEN_CURSOR_BLINK_MAX;
+}
 
-	cell = devcon_page_get_cell(screen->page,
-				    screen->state.cursor_x,
-				    screen->state.cursor_y);
-	if (cell)
-		cell->age = screen->age;
+static inline void screen_age_cursor(struct devcon_screen *screen)
+{
+	devcon_page_age_cell(screen->page,
+			     screen->state.cursor_x,
+			     screen->state.cursor_y,
+			     screen->age);
 }
 
 static void screen_cursor_clear_wrap(struct devcon_screen *screen)
@@ -499,8 +614,34 @@ static void screen_reset_page(struct devcon_screen *screen,
 			  &screen->state.attr, screen->age, false);
 }
 
+/* re-allocate the alternate page if it was released under memory pressure */
+static bool screen_reserve_alt(struct devcon_screen *screen)
+{
+	struct devcon_page *page = screen->page_main;
+	int ret;
+
+	if (!screen->alt_released)
+		return true;
+
+	ret = devcon_page_reserve(screen->page_alt, page->width, page->height,
+				  &screen->state.attr, screen->age);
+	if (ret < 0)
+		return false;
+
+	devcon_page_resize(screen->page_alt, page->width, page->height,
+			   &screen->state.attr, screen->age, NULL);
+	devcon_page_set_scroll_region(screen->page_alt, 0, page->height);
+	screen->alt_released = false;
+	return true;
+}
+
 static void screen_change_alt(struct devcon_screen *screen, bool set)
 {
+	if (set && !screen_reserve_alt(screen)) {
+		pr_debug("cannot allocate alternate screen buffer\n");
+		return;
+	}
+
 	if (set) {
 		screen->page = screen->page_alt;
 		screen->history = NULL;
@@ -678,6 +819,48 @@ static u32 screen_map(struct devcon_screen *screen, u32 val)
 	return (nval == -1U) ? val : nval;
 }
 
+/*
+ * Palette Helpers
+ * The palette is modified via OSC. Modified entries are collected in a bitmask
+ * first, so only cells using one of them are aged once the command is done.
+ */
+
+static void screen_set_color(struct devcon_screen *screen,
+			     unsigned int entry,
+			     const u8 *rgb,
+			     u32 *changed)
+{
+	u8 *p = &screen->palette[entry * 3];
+
+	if (!memcmp(p, rgb, 3))
+		return;
+
+	memcpy(p, rgb, 3);
+	*changed |= BIT(entry);
+}
+
+static void screen_reset_color(struct devcon_screen *screen,
+			       unsigned int entry,
+			       u32 *changed)
+{
+	u8 *p = &screen->palette[entry * 3];
+	u8 old[3];
+
+	memcpy(old, p, 3);
+	devcon_palette_reset(screen->palette, entry);
+	if (memcmp(old, p, 3))
+		*changed |= BIT(entry);
+}
+
+static void screen_age_palette(struct devcon_screen *screen, u32 changed)
+{
+	if (!changed)
+		return;
+
+	devcon_page_age_palette(screen->page_main, changed, screen->age);
+	devcon_page_age_palette(screen->page_alt, changed, screen->age);
+}
+
 /*
  * Command Handlers
  * This is the unofficial documentation of all the DEVCON_CMD_* definitions.
@@ -692,10 +875,58 @@ static int screen_DA1(struct devcon_screen *screen,
 static int screen_LF(struct devcon_screen *screen,
 		     const struct devcon_seq *seq);
 
+/*
+ * Append the combining character @ucs4 to the cell it belongs to. That is the
+ * cell below the cursor if a wrap is pending, otherwise the one left of it.
+ * Trailing cells of wide characters redirect to their head. Returns false if
+ * there is no such cell, in which case the caller prints @ucs4 standalone.
+ */
+static bool screen_append(struct devcon_screen *screen, u32 ucs4)
+{
+	struct devcon_page *page = screen->page;
+	unsigned int x = screen->state.cursor_x, y = screen->state.cursor_y;
+	const struct devcon_cell *cell;
+	struct devcon_cell blank;
+
+	if (!(screen->flags & DEVCON_FLAG_PENDING_WRAP)) {
+		if (x < 1)
+			return false;
+		--x;
+	}
+
+	if (y >= page->height || x >= page->width)
+		return false;
+
+	cell = devcon_line_get_cell(page->lines[y], x, &blank);
+	if (x > 0 && devcon_char_is_null(cell->ch) && !cell->cwidth) {
+		cell = devcon_line_get_cell(page->lines[y], x - 1, &blank);
+		if (cell->cwidth > 1)
+			--x;
+	}
+
+	if (devcon_char_is_null(cell->ch))
+		return false;
+
+	devcon_page_append(page, x, y, ucs4, screen->age);
+	return true;
+}
+
 static int screen_GRAPHIC(struct devcon_screen *screen,
 			  const struct devcon_seq *seq)
 {
 	struct devcon_char ch = DEVCON_CHAR_NULL;
+	unsigned int cwidth;
+	u32 ucs4;
+	int w;
+
+	ucs4 = screen_map(screen, seq->terminator);
+	w = devcon_wcwidth(ucs4);
+
+	/* combining characters do not occupy cells of their own */
+	if (!w && screen_append(screen, ucs4))
+		return 0;
+
+	cwidth = (w > 1 && screen->page->width > 1) ? 2 : 1;
 
 	if (screen->state.cursor_x + 1 == screen->page->width
 	    && screen->flags & DEVCON_FLAG_PENDING_WRAP
@@ -706,20 +937,34 @@ static int screen_GRAPHIC(struct devcon_screen *screen,
 
 	screen_cursor_clear_wrap(screen);
 
-	ch = devcon_char_merge(ch, screen_map(screen, seq->terminator));
+	/* wide characters never get split across lines */
+	if (screen->state.cursor_x + cwidth > screen->page->width) {
+		if (screen->state.auto_wrap) {
+			screen_cursor_down(screen, 1, true);
+			screen_cursor_set(screen, 0, screen->state.cursor_y);
+		} else {
+			screen_cursor_set(screen,
+					  screen->page->width - cwidth,
+					  screen->state.cursor_y);
+		}
+	}
+
+	ch = devcon_char_merge(ch, ucs4);
 	devcon_page_write(screen->page,
 			  screen->state.cursor_x,
 			  screen->state.cursor_y,
 			  ch,
-			  1,
+			  cwidth,
 			  &screen->state.attr,
 			  screen->age,
 			  false);
 
-	if (screen->state.cursor_x + 1 == screen->page->width)
+	if (screen->state.cursor_x + cwidth >= screen->page->width) {
+		screen_cursor_right(screen, cwidth - 1);
 		screen->flags |= DEVCON_FLAG_PENDING_WRAP;
-	else
-		screen_cursor_right(screen, 1);
+	} else {
+		screen_cursor_right(screen, cwidth);
+	}
 
 	return 0;
 }
@@ -1900,7 +2145,7 @@ static int screen_DECSCL(struct devcon_screen *screen,
 			bit = seq->args[1];
 	}
 
-	devcon_screen_hard_reset(screen);
+	screen_hard_reset(screen);
 
 	switch (level) {
 	case 61:
@@ -1978,12 +2223,38 @@ static int screen_DECSCUSR(struct devcon_screen *screen,
 	 * Changing this setting does _not_ affect the cursor visibility itself.
 	 * Use DECTCEM for that.
 	 *
+	 * As an xterm extension, 5 and 6 select a blinking and steady bar. We
+	 * cannot render bars, so we use an underline instead.
+	 *
 	 * Defaults:
 	 *   args[0]: 0
-	 *
-	 * TODO: implement
 	 */
 
+	unsigned int style = 1;
+
+	if (seq->args[0] > 0)
+		style = seq->args[0];
+
+	switch (style) {
+	case 1:
+	case 2:
+		screen->cursor_style = DEVCON_CURSOR_BLOCK;
+		break;
+	case 3:
+	case 4:
+		screen->cursor_style = DEVCON_CURSOR_UNDERLINE;
+		break;
+	case 5:
+	case 6:
+		screen->cursor_style = DEVCON_CURSOR_BAR;
+		break;
+	default:
+		return 0;
+	}
+
+	screen->cursor_blink = style & 1;
+	screen_age_cursor(screen);
+
 	return 0;
 }
 
@@ -3090,6 +3361,213 @@ static int screen_NULL(struct devcon_screen *screen,
 	return 0;
 }
 
+/* return the next ';'-separated field of an OSC string, or NULL */
+static const char *screen_osc_next(const char **p, size_t *len)
+{
+	const char *t = *p, *e;
+
+	if (!t)
+		return NULL;
+
+	e = strchrnul(t, ';');
+	*len = e - t;
+	*p = *e ? e + 1 : NULL;
+	return t;
+}
+
+/* parse a decimal OSC field; returns -1 if it is empty or invalid */
+static int screen_osc_num(const char *t, size_t len)
+{
+	int v = 0;
+
+	if (!t || len < 1 || len > 5)
+		return -1;
+
+	for ( ; len > 0; --len, ++t) {
+		if (*t < '0' || *t > '9')
+			return -1;
+		v = v * 10 + *t - '0';
+	}
+
+	return v;
+}
+
+/*
+ * Parse the X11 color specification @t into @rgb. Both "rgb:r/g/b" and "#rgb"
+ * are supported, with 1 to 4 hex digits per channel. Channels of the former
+ * are scaled, while the latter specifies the most significant bits.
+ */
+static bool screen_osc_color(const char *t, size_t len, u8 *rgb)
+{
+	const char *c[3];
+	size_t n[3], i, j;
+	bool scale;
+	int h;
+	u32 v;
+
+	if (len > 4 && !strncmp(t, "rgb:", 4)) {
+		t += 4;
+		len -= 4;
+		for (i = 0; i < 3; ++i) {
+			c[i] = t;
+			for (n[i] = 0; n[i] < len && t[n[i]] != '/'; ++n[i])
+				/* empty */ ;
+
+			/* only the last channel extends to the end */
+			if ((i < 2) == (n[i] == len))
+				return false;
+
+			t += n[i] + 1;
+			len -= min(len, n[i] + 1);
+		}
+		scale = true;
+	} else if (len > 1 && *t == '#' && (len - 1) % 3 == 0) {
+		for (i = 0; i < 3; ++i) {
+			n[i] = (len - 1) / 3;
+			c[i] = t + 1 + i * n[i];
+		}
+		scale = false;
+	} else {
+		return false;
+	}
+
+	for (i = 0; i < 3; ++i) {
+		if (n[i] < 1 || n[i] > 4)
+			return false;
+
+		for (v = 0, j = 0; j < n[i]; ++j) {
+			h = hex_to_bin(c[i][j]);
+			if (h < 0)
+				return false;
+			v = v * 16 + h;
+		}
+
+		if (scale)
+			rgb[i] = v * 255 / ((1U << (n[i] * 4)) - 1);
+		else if (n[i] <= 2)
+			rgb[i] = v << (8 - n[i] * 4);
+		else
+			rgb[i] = v >> (n[i] * 4 - 8);
+	}
+
+	return true;
+}
+
+/* report @rgb as answer to the OSC @seq, prefixed by the fields in @head */
+static int screen_osc_report(struct devcon_screen *screen,
+			     const struct devcon_seq *seq,
+			     const char *head,
+			     const u8 *rgb)
+{
+	char buf[64];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s;rgb:%04x/%04x/%04x", head,
+		       rgb[0] * 0x101, rgb[1] * 0x101, rgb[2] * 0x101);
+
+	/* the answer uses the same terminator as the query */
+	return SEQ_WRITE(screen, "\e]", "\x9d", "") ?:
+	       screen_write(screen, buf, len) ?:
+	       ((seq->terminator == 0x07) ?
+			screen_write(screen, "\a", 1) :
+			SEQ_WRITE(screen, "\e\\", "\x9c", ""));
+}
+
+static int screen_OSC(struct devcon_screen *screen,
+		      const struct devcon_seq *seq)
+{
+	/*
+	 * OSC - operating-system-command
+	 * The string of an OSC is a command number, followed by ';'-separated
+	 * arguments. Only the color controls of xterm are implemented, other
+	 * commands are ignored:
+	 *   4;c;spec       Set ANSI color @c to @spec. If @spec is "?", the
+	 *                  color is reported instead. Pairs of @c and @spec can
+	 *                  be repeated.
+	 *   10;spec        Same for the default foreground color. A second
+	 *                  @spec applies to the default background color.
+	 *   11;spec        Same for the default background color.
+	 *   104;c          Reset ANSI color @c, or all of them if none is
+	 *                  given. Can be repeated.
+	 *   110, 111       Reset the default foreground or background color.
+	 * Colors are given as X11 color specifications. The 256-color palette
+	 * above the ANSI colors is fixed, so such entries can be reported, but
+	 * not set.
+	 */
+
+	const char *p = seq->st, *t, *spec;
+	size_t len, spec_len;
+	unsigned int entry;
+	u32 changed = 0;
+	char head[16];
+	int cmd, c, ret = 0;
+	u8 rgb[3];
+
+	t = screen_osc_next(&p, &len);
+	cmd = screen_osc_num(t, len);
+
+	switch (cmd) {
+	case 4:
+		while (!ret && (t = screen_osc_next(&p, &len)) &&
+		       (spec = screen_osc_next(&p, &spec_len))) {
+			c = screen_osc_num(t, len);
+			if (c < 0 || c > 255)
+				break;
+
+			if (spec_len == 1 && *spec == '?') {
+				devcon_palette_get_256(screen->palette, c, rgb);
+				snprintf(head, sizeof(head), "4;%d", c);
+				ret = screen_osc_report(screen, seq, head, rgb);
+			} else if (c < 16 &&
+				   screen_osc_color(spec, spec_len, rgb)) {
+				screen_set_color(screen, c, rgb, &changed);
+			}
+		}
+		break;
+	case 10:
+	case 11:
+		for (c = cmd; !ret && c <= 11; ++c) {
+			spec = screen_osc_next(&p, &spec_len);
+			if (!spec)
+				break;
+
+			entry = DEVCON_PALETTE_FG + c - 10;
+			if (spec_len == 1 && *spec == '?') {
+				snprintf(head, sizeof(head), "%d", c);
+				ret = screen_osc_report(screen, seq, head,
+						&screen->palette[entry * 3]);
+			} else if (screen_osc_color(spec, spec_len, rgb)) {
+				screen_set_color(screen, entry, rgb, &changed);
+			}
+		}
+		break;
+	case 104:
+		if (!p) {
+			for (c = 0; c < 16; ++c)
+				screen_reset_color(screen, c, &changed);
+			break;
+		}
+
+		while ((t = screen_osc_next(&p, &len))) {
+			c = screen_osc_num(t, len);
+			if (c >= 0 && c < 16)
+				screen_reset_color(screen, c, &changed);
+		}
+		break;
+	case 110:
+		screen_reset_color(screen, DEVCON_PALETTE_FG, &changed);
+		break;
+	case 111:
+		screen_reset_color(screen, DEVCON_PALETTE_BG, &changed);
+		break;
+	}
+
+	screen_age_palette(screen, changed);
+
+	return ret;
+}
+
+
 static int screen_PP(struct devcon_screen *screen,
 		     const struct devcon_seq *seq)
 {
@@ -3234,7 +3712,7 @@ static int screen_RIS(struct devcon_screen *screen,
 	 * unless you saved a new setting.
 	 */
 
-	devcon_screen_hard_reset(screen);
+	screen_hard_reset(screen);
 
 	return 0;
 }
@@ -3512,10 +3990,10 @@ static int screen_SGR(struct devcon_screen *screen,
 				if (i >= seq->n_args)
 					break;
 
-				dst->ccode = DEVCON_CCODE_RGB;
-				dst->red = (seq->args[i - 2] >= 0) ? seq->args[i - 2] : 0;
-				dst->green = (seq->args[i - 1] >= 0) ? seq->args[i - 1] : 0;
-				dst->blue = (seq->args[i] >= 0) ? seq->args[i] : 0;
+				devcon_color_set_rgb(dst,
+					(seq->args[i - 2] >= 0) ? seq->args[i - 2] : 0,
+					(seq->args[i - 1] >= 0) ? seq->args[i - 1] : 0,
+					(seq->args[i] >= 0) ? seq->args[i] : 0);
 
 				break;
 			case 5:
@@ -3525,9 +4003,8 @@ static int screen_SGR(struct devcon_screen *screen,
 				if (i >= seq->n_args || seq->args[i] < 0)
 					break;
 
-				dst->ccode = DEVCON_CCODE_256;
 				code = seq->args[i];
-				dst->c256 = code < 256 ? code : 0;
+				devcon_color_set_256(dst, code < 256 ? code : 0);
 
 				break;
 			}
@@ -4276,6 +4753,8 @@ static int screen_feed_cmd(struct devcon_screen *screen,
 		return screen_NP(screen, seq);
 	case DEVCON_CMD_NULL:
 		return screen_NULL(screen, seq);
+	case DEVCON_CMD_OSC:
+		return screen_OSC(screen, seq);
 	case DEVCON_CMD_PP:
 		return screen_PP(screen, seq);
 	case DEVCON_CMD_PPA:
@@ -4372,6 +4851,96 @@ static int screen_feed_cmd(struct devcon_screen *screen,
 	return 0;
 }
 
+/**
+ * devcon_screen_get_size() - Return memory used by a screen
+ * @screen:		screen to query
+ *
+ * Returns: Number of bytes allocated for pages, history and tab-stops of
+ *          @screen.
+ */
+size_t devcon_screen_get_size(struct devcon_screen *screen)
+{
+	return sizeof(*screen) +
+	       devcon_page_get_size(screen->page_main) +
+	       devcon_page_get_size(screen->page_alt) +
+	       devcon_history_get_size(screen->history_main) +
+	       (screen->n_tabs + 7) / 8;
+}
+
+/**
+ * devcon_screen_get_reclaimable() - Return reclaimable memory of a screen
+ * @screen:		screen to query
+ * @floor:		number of history lines to keep
+ *
+ * Returns: Number of bytes devcon_screen_shrink() could release.
+ */
+size_t devcon_screen_get_reclaimable(struct devcon_screen *screen,
+				     unsigned int floor)
+{
+	size_t size;
+
+	size = devcon_history_get_reclaimable(screen->history_main, floor);
+	if (screen->page != screen->page_alt && !screen->alt_released)
+		size += devcon_page_get_size(screen->page_alt);
+
+	return size;
+}
+
+/**
+ * devcon_screen_shrink() - Release memory of a screen
+ * @screen:		screen to shrink
+ * @floor:		number of history lines to keep
+ * @target:		number of bytes to release
+ * @gfp:		allocation flags to use
+ *
+ * This releases up to roughly @target bytes of memory that is not needed to
+ * render @screen. First, the scrollback buffer is trimmed down to @floor lines
+ * and the unused capacity of history lines is released. If that is not
+ * enough, the alternate screen buffer is released, unless it is in use. It
+ * is allocated again once the application switches to it.
+ *
+ * Returns: Number of bytes released.
+ */
+size_t devcon_screen_shrink(struct devcon_screen *screen,
+			    unsigned int floor,
+			    size_t target,
+			    gfp_t gfp)
+{
+	size_t size;
+
+	size = devcon_history_shrink(screen->history_main, floor, target, gfp);
+
+	if (size < target && screen->page != screen->page_alt &&
+	    !screen->alt_released) {
+		size += devcon_page_release(screen->page_alt);
+		screen->alt_released = true;
+	}
+
+	screen_verify_shrink(screen, floor, target, gfp);
+
+	return size;
+}
+
+/**
+ * devcon_screen_export() - Export scrollback buffer as text
+ * @screen:		screen to export
+ * @m:			seq_file to write to
+ * @since:		wall-clock time to start at, in seconds since the epoch
+ *
+ * This writes all scrollback lines of @screen that were pushed at, or after,
+ * @since to @m, each prefixed with its timestamp. The first line is found via
+ * binary search, see devcon_history_find_time(). Pass 0 to export all lines.
+ */
+void devcon_screen_export(struct devcon_screen *screen,
+			  struct seq_file *m,
+			  time64_t since)
+{
+	struct devcon_history *history = screen->history_main;
+
+	devcon_history_export(history, m,
+			      devcon_history_find_time(history, since));
+}
+
 unsigned int devcon_screen_get_width(struct devcon_screen *screen)
 {
 	return screen->page->width;
@@ -4387,7 +4956,70 @@ u64 devcon_screen_get_age(struct devcon_screen *screen)
 	return screen->age;
 }
 
-int devcon_screen_feed_text(struct devcon_screen *screen,
+/**
+ * devcon_screen_get_palette() - Return the palette of a screen
+ * @screen: screen to query
+ *
+ * The palette can be modified by the application via OSC. Cells using a
+ * modified entry are aged, so they are redrawn by the next draw pass.
+ *
+ * Returns: The palette of @screen, in the layout used by page.h.
+ */
+const u8 *devcon_screen_get_palette(struct devcon_screen *screen)
+{
+	return screen->palette;
+}
+
+/**
+ * devcon_screen_is_blinking() - Check whether anything on a screen blinks
+ * @screen: screen to query
+ *
+ * The cursor only blinks for a limited number of phases after the last output,
+ * so an idle screen does not need a blink timer.
+ *
+ * Returns: True if the cursor blinks, or if the page might contain cells with
+ *          the blink attribute set. False otherwise.
+ */
+bool devcon_screen_is_blinking(struct devcon_screen *screen)
+{
+	return screen_cursor_blinks(screen) ||
+	       devcon_page_has_blink(screen->page);
+}
+
+/**
+ * devcon_screen_blink() - Advance the blink phase of a screen
+ * @screen: screen to operate on
+ *
+ * This toggles the blink phase of @screen. Only the cells with the blink
+ * attribute set, and the cursor cell if the cursor blinks, are aged. Hence,
+ * the next devcon_screen_draw() with a valid fb-age redraws just those cells.
+ *
+ * Returns: True if any cell was aged, false if nothing on @screen blinks.
+ */
+bool devcon_screen_blink(struct devcon_screen *screen)
+{
+	bool aged;
+
+	++screen->age;
+	screen->blink_off = !screen->blink_off;
+
+	aged = devcon_page_age_blink(screen->page, screen->age);
+
+	/* once the limit is hit, the cursor is drawn steady in this pass */
+	if (screen_cursor_blinks(screen)) {
+		++screen->cursor_blinks;
+		screen_age_cursor(screen);
+		aged = true;
+	}
+
+	/* make sure content is shown once blinking stops */
+	if (!aged)
+		screen->blink_off = false;
+
+	return aged;
+}
+
+static int screen_feed_text(struct devcon_screen *screen,
 			    const u8 *in,
 			    size_t size)
 {
@@ -4426,6 +5058,21 @@ int devcon_screen_feed_text(struct devcon_screen *screen,
 	return 0;
 }
 
+int devcon_screen_feed_text(struct devcon_screen *screen,
+			    const u8 *in,
+			    size_t size)
+{
+	int ret;
+
+	/* output restarts the blink timeout of the cursor */
+	screen->cursor_blinks = 0;
+
+	ret = screen_feed_text(screen, in, size);
+	screen_verify_feed(screen, in, size);
+
+	return ret;
+}
+
 static char *screen_map_key(unsigned int flags,
 			    char *p,
 			    const u32 *keysyms,
@@ -4798,13 +5445,15 @@ int devcon_screen_resize(struct devcon_screen *screen,
 	if (ret < 0)
 		return ret;
 
-	ret = devcon_page_reserve(screen->page_alt, x, y,
-				  &screen->state.attr, screen->age);
-	if (ret < 0)
-		return ret;
+	if (!screen->alt_released) {
+		ret = devcon_page_reserve(screen->page_alt, x, y,
+					  &screen->state.attr, screen->age);
+		if (ret < 0)
+			return ret;
+	}
 
 	if (x > screen->n_tabs) {
-		t = krealloc(screen->tabs, (x + 7) / 8, GFP_KERNEL);
+		t = krealloc(screen->tabs, (x + 7) / 8, DEVCON_GFP);
 		if (!t)
 			return -ENOMEM;
 
@@ -4817,13 +5466,16 @@ int devcon_screen_resize(struct devcon_screen *screen,
 
 	devcon_page_resize(screen->page_main, x, y, &screen->state.attr,
 			   screen->age, screen->history);
-	devcon_page_resize(screen->page_alt, x, y, &screen->state.attr,
-			   screen->age, NULL);
+	if (!screen->alt_released)
+		devcon_page_resize(screen->page_alt, x, y, &screen->state.attr,
+				   screen->age, NULL);
 
 	screen->state.cursor_x = screen_clamp_x(screen, screen->state.cursor_x);
 	screen->state.cursor_y = screen_clamp_x(screen, screen->state.cursor_y);
 	screen_cursor_clear_wrap(screen);
 
+	screen_verify_resize(screen, x, y);
+
 	return 0;
 }
 
@@ -4862,8 +5514,15 @@ void devcon_screen_soft_reset(struct devcon_screen *screen)
 				      screen->page->height);
 }
 
-void devcon_screen_hard_reset(struct devcon_screen *screen)
+static void screen_hard_reset(struct devcon_screen *screen)
 {
+	u32 changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < DEVCON_PALETTE_N; ++i)
+		screen_reset_color(screen, i, &changed);
+	screen_age_palette(screen, changed);
+
 	devcon_screen_soft_reset(screen);
 	memset(&screen->utf8, 0, sizeof(screen->utf8));
 	screen->state.cursor_x = 0;
@@ -4876,13 +5535,19 @@ void devcon_screen_hard_reset(struct devcon_screen *screen)
 			  screen->age, false);
 }
 
+void devcon_screen_hard_reset(struct devcon_screen *screen)
+{
+	screen_hard_reset(screen);
+	screen_verify_hard_reset(screen);
+}
+
 int devcon_screen_set_answerback(struct devcon_screen *screen,
 				 const char *answerback)
 {
 	char *t = NULL;
 
 	if (answerback) {
-		t = kstrdup(answerback, GFP_KERNEL);
+		t = kstrdup(answerback, DEVCON_GFP);
 		if (!t)
 			return -ENOMEM;
 	}
@@ -4893,31 +5558,350 @@ int devcon_screen_set_answerback(struct devcon_screen *screen,
 	return 0;
 }
 
-int devcon_screen_draw(struct devcon_screen *screen,
-		       int (*draw_fn) (struct devcon_screen *screen,
-				       void *userdata,
-				       unsigned int x,
-				       unsigned int y,
-				       const struct devcon_attr *attr,
-				       const u32 *ch,
-				       size_t n_ch,
-				       unsigned int ch_width),
+/*
+ * Serialization
+ * A screen is serialized with its modes, cursor states, charsets, tab-stops,
+ * history and pages, so it can be restored after a reload of the module.
+ * Parser state and partial UTF-8 sequences are not preserved. Charsets are
+ * stored as index into screen_charsets[], and the charset slots of each state
+ * as index of g0 to g3.
+ */
+
+static devcon_charset *screen_charsets[] = {
+	&devcon_unicode_lower,
+	&devcon_unicode_upper,
+	&devcon_dec_supplemental_graphics,
+	&devcon_dec_special_graphics,
+};
+
+static u8 screen_charset_to_id(devcon_charset *cs)
+{
+	u8 i;
+
+	for (i = 0; i < ARRAY_SIZE(screen_charsets); ++i)
+		if (screen_charsets[i] == cs)
+			return i;
+
+	return 0;
+}
+
+static devcon_charset *screen_charset_from_id(u8 id, devcon_charset *def)
+{
+	return id < ARRAY_SIZE(screen_charsets) ? screen_charsets[id] : def;
+}
+
+static u8 screen_slot_to_id(struct devcon_screen *screen,
+			    devcon_charset **slot)
+{
+	if (slot == &screen->g0)
+		return 0;
+	if (slot == &screen->g1)
+		return 1;
+	if (slot == &screen->g2)
+		return 2;
+	if (slot == &screen->g3)
+		return 3;
+	return 0xff;
+}
+
+static devcon_charset **screen_slot_from_id(struct devcon_screen *screen,
+					    u8 id)
+{
+	switch (id) {
+	case 0:
+		return &screen->g0;
+	case 1:
+		return &screen->g1;
+	case 2:
+		return &screen->g2;
+	case 3:
+		return &screen->g3;
+	}
+
+	return NULL;
+}
+
+static void screen_save_cursor(struct devcon_screen *screen,
+			       const struct devcon_state *state,
+			       struct devcon_stream *s)
+{
+	u8 buf[6];
+
+	devcon_stream_write_u32(s, state->cursor_x);
+	devcon_stream_write_u32(s, state->cursor_y);
+	devcon_attr_save(&state->attr, s);
+
+	buf[0] = screen_slot_to_id(screen, state->gl);
+	buf[1] = screen_slot_to_id(screen, state->gr);
+	buf[2] = screen_slot_to_id(screen, state->glt);
+	buf[3] = screen_slot_to_id(screen, state->grt);
+	buf[4] = state->auto_wrap;
+	buf[5] = state->origin_mode;
+	devcon_stream_write(s, buf, sizeof(buf));
+}
+
+static int screen_load_cursor(struct devcon_screen *screen,
+			      struct devcon_state *state,
+			      struct devcon_stream *s)
+{
+	u32 x, y;
+	u8 buf[6];
+	int ret;
+
+	ret = devcon_stream_read_u32(s, &x) ?:
+	      devcon_stream_read_u32(s, &y) ?:
+	      devcon_attr_load(&state->attr, s) ?:
+	      devcon_stream_read(s, buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+
+	state->cursor_x = screen_clamp_x(screen, x);
+	state->cursor_y = screen_clamp_y(screen, y);
+	state->gl = screen_slot_from_id(screen, buf[0]) ? : &screen->g0;
+	state->gr = screen_slot_from_id(screen, buf[1]) ? : &screen->g1;
+	state->glt = screen_slot_from_id(screen, buf[2]);
+	state->grt = screen_slot_from_id(screen, buf[3]);
+	state->auto_wrap = buf[4];
+	state->origin_mode = buf[5];
+
+	return 0;
+}
+
+/**
+ * devcon_screen_save() - Serialize a screen
+ * @screen: screen to serialize
+ * @s: stream to write to
+ *
+ * This writes the state of @screen to @s in a single pass. If @s has no
+ * buffer, only the required size is calculated. Use devcon_screen_load() to
+ * restore the state.
+ */
+void devcon_screen_save(struct devcon_screen *screen, struct devcon_stream *s)
+{
+	size_t len = screen->answerback ? strlen(screen->answerback) : 0;
+	u8 buf[7];
+
+	devcon_stream_write_u32(s, screen->page_main->width);
+	devcon_stream_write_u32(s, screen->page_main->height);
+	devcon_stream_write_u32(s, screen->flags);
+	devcon_stream_write_u32(s, screen->conformance_level);
+	devcon_stream_write_u32(s, screen->cursor_style);
+	devcon_attr_save(&screen->default_attr, s);
+
+	buf[0] = screen->cursor_blink;
+	buf[1] = screen->page == screen->page_alt;
+	buf[2] = screen->alt_released;
+	buf[3] = screen_charset_to_id(screen->g0);
+	buf[4] = screen_charset_to_id(screen->g1);
+	buf[5] = screen_charset_to_id(screen->g2);
+	buf[6] = screen_charset_to_id(screen->g3);
+	devcon_stream_write(s, buf, sizeof(buf));
+
+	screen_save_cursor(screen, &screen->state, s);
+	screen_save_cursor(screen, &screen->saved, s);
+	screen_save_cursor(screen, &screen->saved_alt, s);
+
+	devcon_stream_write(s, screen->tabs, (screen->page_main->width + 7) / 8);
+
+	devcon_stream_write_u32(s, len);
+	devcon_stream_write(s, screen->answerback, len);
+	devcon_stream_write(s, screen->palette, sizeof(screen->palette));
+
+	devcon_history_save(screen->history_main, s);
+	devcon_page_save(screen->page_main, s);
+	if (!screen->alt_released)
+		devcon_page_save(screen->page_alt, s);
+}
+
+/**
+ * devcon_screen_load() - Restore a serialized screen
+ * @screen: screen to restore into
+ * @s: stream to read from
+ *
+ * This reads a screen written by devcon_screen_save() from @s and applies it
+ * to @screen, including its dimensions. If this fails, @screen is left in a
+ * valid, but undefined state. The caller should reset it in that case.
+ *
+ * Returns: 0 on success, negative error code on failure.
+ */
+int devcon_screen_load(struct devcon_screen *screen, struct devcon_stream *s)
+{
+	u32 width, height, flags, level, style, len;
+	size_t pos = s->pos;
+	struct devcon_attr attr;
+	char *answerback;
+	u8 buf[7];
+	int ret;
+
+	ret = devcon_stream_read_u32(s, &width) ?:
+	      devcon_stream_read_u32(s, &height) ?:
+	      devcon_stream_read_u32(s, &flags) ?:
+	      devcon_stream_read_u32(s, &level) ?:
+	      devcon_stream_read_u32(s, &style) ?:
+	      devcon_attr_load(&attr, s) ?:
+	      devcon_stream_read(s, buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+
+	if (!width || !height || level >= DEVCON_CONFORMANCE_LEVEL_N)
+		return -EINVAL;
+
+	/* the alternate page is restored only if it was saved */
+	if (screen->page == screen->page_alt)
+		screen_change_alt(screen, false);
+	screen->alt_released = false;
+
+	ret = devcon_screen_resize(screen, width, height);
+	if (ret < 0)
+		return ret;
+
+	screen->flags = flags;
+	screen->conformance_level = level;
+	screen->cursor_style = style;
+	screen->default_attr = attr;
+	screen->cursor_blink = buf[0];
+	screen->g0 = screen_charset_from_id(buf[3], &devcon_unicode_lower);
+	screen->g1 = screen_charset_from_id(buf[4], &devcon_unicode_upper);
+	screen->g2 = screen_charset_from_id(buf[5], &devcon_unicode_lower);
+	screen->g3 = screen_charset_from_id(buf[6], &devcon_unicode_upper);
+
+	ret = screen_load_cursor(screen, &screen->state, s) ?:
+	      screen_load_cursor(screen, &screen->saved, s) ?:
+	      screen_load_cursor(screen, &screen->saved_alt, s) ?:
+	      devcon_stream_read(s, screen->tabs, (width + 7) / 8) ?:
+	      devcon_stream_read_u32(s, &len);
+	if (ret < 0)
+		return ret;
+
+	if (len > s->size - s->pos)
+		return -EINVAL;
+
+	answerback = NULL;
+	if (len) {
+		answerback = kmalloc(len + 1, DEVCON_GFP);
+		if (!answerback)
+			return -ENOMEM;
+
+		devcon_stream_read(s, answerback, len);
+		answerback[len] = 0;
+	}
+
+	kfree(screen->answerback);
+	screen->answerback = answerback;
+
+	ret = devcon_stream_read(s, screen->palette, sizeof(screen->palette));
+	if (ret < 0)
+		return ret;
+
+	ret = devcon_history_load(screen->history_main, s, screen->age) ?:
+	      devcon_page_load(screen->page_main, s, screen->age);
+	if (ret < 0)
+		return ret;
+
+	if (buf[2]) {
+		devcon_page_release(screen->page_alt);
+		screen->alt_released = true;
+	} else {
+		ret = devcon_page_load(screen->page_alt, s, screen->age);
+		if (ret < 0)
+			return ret;
+
+		if (buf[1])
+			screen_change_alt(screen, true);
+	}
+
+	screen->blink_off = false;
+
+	screen_verify_load(screen, s, pos);
+
+	return 0;
+}
+
+struct screen_fill {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+	struct devcon_attr attr;
+};
+
+static int screen_flush_fill(struct devcon_screen *screen,
+			     devcon_screen_fill_fn fill_fn,
+			     void *userdata,
+			     struct screen_fill *fill)
+{
+	int ret;
+
+	if (!fill->width)
+		return 0;
+
+	ret = fill_fn(screen, userdata, fill->x, fill->y,
+		      fill->width, fill->height, &fill->attr);
+	fill->width = 0;
+	return ret;
+}
+
+/*
+ * Queue a run of blank cells for filling. Runs spanning the whole width are
+ * merged with the pending run of the previous row, if their attributes match,
+ * so cleared areas result in a single rectangle.
+ */
+static int screen_queue_fill(struct devcon_screen *screen,
+			     devcon_screen_fill_fn fill_fn,
+			     void *userdata,
+			     struct screen_fill *pending,
+			     struct screen_fill *run)
+{
+	int ret;
+
+	if (!run->width)
+		return 0;
+
+	if (pending->width == screen->page->width &&
+	    run->width == screen->page->width &&
+	    pending->y + pending->height == run->y &&
+	    devcon_attr_equal(&pending->attr, &run->attr)) {
+		++pending->height;
+		run->width = 0;
+		return 0;
+	}
+
+	ret = screen_flush_fill(screen, fill_fn, userdata, pending);
+	*pending = *run;
+	run->width = 0;
+	return ret;
+}
+
+static bool screen_cell_is_blank(const struct devcon_attr *attr,
+				 const u32 *ch,
+				 size_t n_ch)
+{
+	if (attr->hidden)
+		return true;
+	if (attr->underline)
+		return false;
+
+	return n_ch == 0 || (n_ch == 1 && (ch[0] == ' ' || ch[0] == 0));
+}
+
+static int screen_draw(struct devcon_screen *screen,
+		       devcon_screen_draw_fn draw_fn,
+		       devcon_screen_fill_fn fill_fn,
 		       void *userdata,
 		       u64 *fb_age)
 {
+	struct screen_fill pending = {}, run = {};
 	u64 cell_age, line_age, age = 0;
 	struct devcon_charbuf ch_buf;
 	const u32 *ch_str;
 	unsigned int i, j, cw;
 	struct devcon_page *page;
+	const struct devcon_cell *cell;
+	struct devcon_cell blank;
 	struct devcon_line *line;
-	struct devcon_cell *cell;
 	size_t ch_n;
 	int ret;
 
-	if (WARN_ON(!screen || !draw_fn))
-		return -EINVAL;
-
 	if (fb_age)
 		age = *fb_age;
 
@@ -4930,11 +5914,17 @@ int devcon_screen_draw(struct devcon_screen *screen,
 		for (i = 0; i < page->width; ++i) {
 			struct devcon_attr attr;
 
-			cell = &line->cells[i];
+			cell = devcon_line_get_cell(line, i, &blank);
 			cell_age = max(cell->age, line_age);
 
-			if (age != 0 && cell_age <= age)
+			if (age != 0 && cell_age <= age) {
+				ret = screen_queue_fill(screen, fill_fn,
+							userdata, &pending,
+							&run);
+				if (ret != 0)
+					return ret;
 				continue;
+			}
 
 			ch_str = devcon_char_resolve(cell->ch, &ch_n, &ch_buf);
 
@@ -4943,13 +5933,51 @@ int devcon_screen_draw(struct devcon_screen *screen,
 			 * Always treat this as single-cell character, so
 			 * renderers can assume ch_width is set properpy.
 			 */
-			cw = max(cell->cwidth, 1U);
+			cw = max_t(unsigned int, cell->cwidth, 1);
 
 			attr = cell->attr;
+			if (attr.blink && screen->blink_off)
+				attr.hidden = 1;
+
 			if (i == screen->state.cursor_x &&
 			    j == screen->state.cursor_y &&
-			    !(screen->flags & DEVCON_FLAG_HIDE_CURSOR))
-				attr.inverse ^= 1;
+			    !(screen->flags & DEVCON_FLAG_HIDE_CURSOR) &&
+			    !(screen_cursor_blinks(screen) && screen->blink_off)) {
+				if (screen->cursor_style == DEVCON_CURSOR_BLOCK)
+					attr.inverse ^= 1;
+				else
+					attr.underline ^= 1;
+			}
+
+			if (fill_fn && cw == 1 &&
+			    screen_cell_is_blank(&attr, ch_str, ch_n)) {
+				if (run.width && devcon_attr_equal(&run.attr,
+								   &attr)) {
+					++run.width;
+					continue;
+				}
+
+				ret = screen_queue_fill(screen, fill_fn,
+							userdata, &pending,
+							&run);
+				if (ret != 0)
+					return ret;
+
+				run.x = i;
+				run.y = j;
+				run.width = 1;
+				run.height = 1;
+				run.attr = attr;
+				continue;
+			}
+
+			if (fill_fn) {
+				ret = screen_queue_fill(screen, fill_fn,
+							userdata, &pending,
+							&run);
+				if (ret != 0)
+					return ret;
+			}
 
 			ret = draw_fn(screen,
 				      userdata,
@@ -4962,6 +5990,19 @@ int devcon_screen_draw(struct devcon_screen *screen,
 			if (ret != 0)
 				return ret;
 		}
+
+		if (fill_fn) {
+			ret = screen_queue_fill(screen, fill_fn, userdata,
+						&pending, &run);
+			if (ret != 0)
+				return ret;
+		}
+	}
+
+	if (fill_fn) {
+		ret = screen_flush_fill(screen, fill_fn, userdata, &pending);
+		if (ret != 0)
+			return ret;
 	}
 
 	if (fb_age)
@@ -4969,3 +6010,360 @@ int devcon_screen_draw(struct devcon_screen *screen,
 
 	return 0;
 }
+
+#ifdef CONFIG_DEVCON_VERIFY
+
+struct screen_verify_cell {
+	struct devcon_attr attr;
+	u32 ch;
+	size_t n_ch;
+	unsigned int cwidth;
+};
+
+struct screen_verify_render {
+	devcon_screen_draw_fn draw_fn;
+	devcon_screen_fill_fn fill_fn;
+	void *userdata;
+	struct screen_verify_cell *grid;
+	unsigned int width;
+	unsigned int height;
+};
+
+static bool screen_verify_first(struct devcon_screen *screen)
+{
+	if (screen->verify_failed)
+		return false;
+
+	screen->verify_failed = true;
+	return true;
+}
+
+static int screen_verify_new(struct devcon_screen *screen)
+{
+	return screen_new(&screen->shadow, NULL, NULL, NULL, NULL);
+}
+
+static void screen_verify_free(struct devcon_screen *screen)
+{
+	kfree(screen->verify_grid);
+	screen->shadow = devcon_screen_free(screen->shadow);
+}
+
+static bool screen_verify_page(struct devcon_page *a,
+			       struct devcon_page *b,
+			       unsigned int *x,
+			       unsigned int *y)
+{
+	const struct devcon_cell *ca, *cb;
+	struct devcon_cell blank_a, blank_b;
+	unsigned int i, j;
+
+	*x = 0;
+	*y = 0;
+
+	if (a->width != b->width || a->height != b->height)
+		return false;
+
+	for (j = 0; j < a->height; ++j) {
+		for (i = 0; i < a->width; ++i) {
+			ca = devcon_line_get_cell(a->lines[j], i, &blank_a);
+			cb = devcon_line_get_cell(b->lines[j], i, &blank_b);
+
+			if (!devcon_char_equal(ca->ch, cb->ch) ||
+			    ca->cwidth != cb->cwidth ||
+			    !devcon_attr_equal(&ca->attr, &cb->attr)) {
+				*x = i;
+				*y = j;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Compare @screen against its shadow. Only state that affects rendering or
+ * the interpretation of future input is compared. Ages are not, as they
+ * depend on how the input was chunked.
+ */
+static const char *screen_verify_compare(struct devcon_screen *screen,
+					 unsigned int *x,
+					 unsigned int *y)
+{
+	struct devcon_screen *shadow = screen->shadow;
+
+	*x = screen->state.cursor_x;
+	*y = screen->state.cursor_y;
+
+	if (screen->state.cursor_x != shadow->state.cursor_x ||
+	    screen->state.cursor_y != shadow->state.cursor_y)
+		return "cursor";
+	if (screen->flags != shadow->flags)
+		return "flags";
+	if ((screen->page == screen->page_alt) !=
+	    (shadow->page == shadow->page_alt))
+		return "active page";
+	if (screen->history_main->n_lines != shadow->history_main->n_lines)
+		return "history";
+	if (!screen_verify_page(screen->page_main, shadow->page_main, x, y))
+		return "main page";
+	if (screen->alt_released != shadow->alt_released)
+		return "alternate page";
+	if (!screen->alt_released &&
+	    !screen_verify_page(screen->page_alt, shadow->page_alt, x, y))
+		return "alternate page";
+
+	return NULL;
+}
+
+/*
+ * The shadow takes the reference path: every byte is fed on its own, so no
+ * state can be carried across a chunk that the per-character parser would
+ * not carry across a byte.
+ */
+static void screen_verify_feed(struct devcon_screen *screen,
+			       const u8 *in,
+			       size_t size)
+{
+	unsigned int x, y;
+	const char *what;
+	size_t i;
+	u64 offset;
+
+	if (!screen->shadow)
+		return;
+
+	offset = screen->verify_offset;
+	screen->verify_offset += size;
+
+	for (i = 0; i < size; ++i)
+		screen_feed_text(screen->shadow, in + i, 1);
+
+	what = screen_verify_compare(screen, &x, &y);
+	if (what && screen_verify_first(screen))
+		pr_warn("verify: %s diverged at %u,%u in input chunk at offset %llu (%zu bytes)\n",
+			what, x, y, (unsigned long long)offset, size);
+}
+
+static void screen_verify_resize(struct devcon_screen *screen,
+				 unsigned int x,
+				 unsigned int y)
+{
+	if (screen->shadow)
+		devcon_screen_resize(screen->shadow, x, y);
+}
+
+static void screen_verify_shrink(struct devcon_screen *screen,
+				 unsigned int floor,
+				 size_t target,
+				 gfp_t gfp)
+{
+	if (screen->shadow)
+		devcon_screen_shrink(screen->shadow, floor, target, gfp);
+}
+
+static void screen_verify_hard_reset(struct devcon_screen *screen)
+{
+	if (screen->shadow)
+		screen_hard_reset(screen->shadow);
+}
+
+static void screen_verify_load(struct devcon_screen *screen,
+			       const struct devcon_stream *s,
+			       size_t pos)
+{
+	struct devcon_stream t = *s;
+
+	if (!screen->shadow)
+		return;
+
+	t.pos = pos;
+	if (devcon_screen_load(screen->shadow, &t) < 0 &&
+	    screen_verify_first(screen))
+		pr_warn("verify: cannot restore shadow screen\n");
+}
+
+static void screen_verify_set(struct screen_verify_render *r,
+			      unsigned int x,
+			      unsigned int y,
+			      const struct devcon_attr *attr,
+			      u32 ch,
+			      size_t n_ch,
+			      unsigned int cwidth)
+{
+	struct screen_verify_cell *cell;
+
+	if (x >= r->width || y >= r->height)
+		return;
+
+	cell = &r->grid[y * r->width + x];
+	cell->attr = *attr;
+	cell->ch = ch;
+	cell->n_ch = n_ch;
+	cell->cwidth = cwidth;
+
+	/* hiding a blank cell has no visible effect */
+	if (!n_ch)
+		cell->attr.hidden = 0;
+}
+
+static int screen_verify_draw_fn(struct devcon_screen *screen,
+				 void *userdata,
+				 unsigned int x,
+				 unsigned int y,
+				 const struct devcon_attr *attr,
+				 const u32 *ch,
+				 size_t n_ch,
+				 unsigned int ch_width)
+{
+	struct screen_verify_render *r = userdata;
+
+	/* blank cells look the same whether they are drawn or filled */
+	if (ch_width == 1 && screen_cell_is_blank(attr, ch, n_ch))
+		screen_verify_set(r, x, y, attr, 0, 0, 1);
+	else
+		screen_verify_set(r, x, y, attr, n_ch ? ch[0] : 0, n_ch,
+				  ch_width);
+
+	if (!r->draw_fn)
+		return 0;
+
+	return r->draw_fn(screen, r->userdata, x, y, attr, ch, n_ch,
+			  ch_width);
+}
+
+static int screen_verify_fill_fn(struct devcon_screen *screen,
+				 void *userdata,
+				 unsigned int x,
+				 unsigned int y,
+				 unsigned int width,
+				 unsigned int height,
+				 const struct devcon_attr *attr)
+{
+	struct screen_verify_render *r = userdata;
+	unsigned int i, j;
+
+	for (j = y; j < y + height; ++j)
+		for (i = x; i < x + width; ++i)
+			screen_verify_set(r, i, j, attr, 0, 0, 1);
+
+	if (!r->fill_fn)
+		return 0;
+
+	return r->fill_fn(screen, r->userdata, x, y, width, height, attr);
+}
+
+/*
+ * Render @screen via the caller's callbacks. If the target was rendered by us
+ * at the age of the last recorded frame, the cells passed to the callbacks
+ * are applied on top of that frame, and the result must match a full render
+ * of @screen, which is recorded as new frame afterwards.
+ */
+static int screen_verify_draw(struct devcon_screen *screen,
+			      devcon_screen_draw_fn draw_fn,
+			      devcon_screen_fill_fn fill_fn,
+			      void *userdata,
+			      u64 *fb_age)
+{
+	struct screen_verify_render r = {
+		.draw_fn = draw_fn,
+		.fill_fn = fill_fn,
+		.userdata = userdata,
+		.width = screen->page->width,
+		.height = screen->page->height,
+	};
+	struct screen_verify_render full = {
+		.width = r.width,
+		.height = r.height,
+	};
+	const struct screen_verify_cell *a, *b;
+	unsigned int i, n;
+	bool valid;
+	int ret;
+
+	valid = fb_age && *fb_age && *fb_age == screen->verify_age &&
+		screen->verify_grid &&
+		screen->verify_width == r.width &&
+		screen->verify_height == r.height;
+
+	if (valid) {
+		r.grid = screen->verify_grid;
+		ret = screen_draw(screen, screen_verify_draw_fn,
+				  fill_fn ? screen_verify_fill_fn : NULL,
+				  &r, fb_age);
+	} else {
+		ret = screen_draw(screen, draw_fn, fill_fn, userdata, fb_age);
+	}
+	if (ret != 0 || !fb_age)
+		return ret;
+
+	n = r.width * r.height;
+	full.grid = kcalloc(n, sizeof(*full.grid), DEVCON_GFP);
+	if (!full.grid)
+		return 0;
+
+	screen_draw(screen, screen_verify_draw_fn,
+		    fill_fn ? screen_verify_fill_fn : NULL, &full, NULL);
+
+	for (i = 0; valid && i < n; ++i) {
+		a = &r.grid[i];
+		b = &full.grid[i];
+
+		if (a->ch != b->ch || a->n_ch != b->n_ch ||
+		    a->cwidth != b->cwidth ||
+		    !devcon_attr_equal(&a->attr, &b->attr)) {
+			if (screen_verify_first(screen))
+				pr_warn("verify: render diverged at %u,%u after input offset %llu\n",
+					i % r.width, i / r.width,
+					(unsigned long long)
+					screen->verify_offset);
+			break;
+		}
+	}
+
+	kfree(screen->verify_grid);
+	screen->verify_grid = full.grid;
+	screen->verify_width = full.width;
+	screen->verify_height = full.height;
+	screen->verify_age = screen->age;
+
+	return 0;
+}
+
+#endif
+
+/**
+ * devcon_screen_draw() - Render a screen
+ * @screen:		screen to render
+ * @draw_fn:		callback to draw a single cell
+ * @fill_fn:		callback to fill blank areas, or NULL
+ * @userdata:		userdata passed to the callbacks
+ * @fb_age:		age of the target, or NULL
+ *
+ * This calls @draw_fn for each cell that changed since @fb_age (or all cells
+ * if @fb_age is NULL or 0), and stores the current age in @fb_age afterwards.
+ *
+ * If @fill_fn is given, blank cells are not passed to @draw_fn. Instead,
+ * consecutive blank cells with equal attributes are collected into rows, and
+ * rows spanning the whole width into rectangles, which are passed to @fill_fn
+ * so they can be cleared in one go.
+ *
+ * Returns: 0 on success, otherwise the first non-zero return value of a
+ *          callback.
+ */
+int devcon_screen_draw(struct devcon_screen *screen,
+		       devcon_screen_draw_fn draw_fn,
+		       devcon_screen_fill_fn fill_fn,
+		       void *userdata,
+		       u64 *fb_age)
+{
+	if (WARN_ON(!screen || !draw_fn))
+		return -EINVAL;
+
+#ifdef CONFIG_DEVCON_VERIFY
+	return screen_verify_draw(screen, draw_fn, fill_fn, userdata, fb_age);
+#else
+	return screen_draw(screen, draw_fn, fill_fn, userdata, fb_age);
+#endif
+}
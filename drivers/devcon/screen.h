@@ -31,6 +31,21 @@ typedef int (*devcon_screen_cmd_fn) (struct devcon_screen *screen,
 				     void *userdata,
 				     unsigned int cmd,
 				     const struct devcon_seq *seq);
+typedef int (*devcon_screen_draw_fn) (struct devcon_screen *screen,
+				      void *userdata,
+				      unsigned int x,
+				      unsigned int y,
+				      const struct devcon_attr *attr,
+				      const u32 *ch,
+				      size_t n_ch,
+				      unsigned int ch_width);
+typedef int (*devcon_screen_fill_fn) (struct devcon_screen *screen,
+				      void *userdata,
+				      unsigned int x,
+				      unsigned int y,
+				      unsigned int width,
+				      unsigned int height,
+				      const struct devcon_attr *attr);
 
 int devcon_screen_new(struct devcon_screen **out,
 		      devcon_screen_write_fn write_fn,
@@ -42,6 +57,19 @@ struct devcon_screen *devcon_screen_free(struct devcon_screen *screen);
 unsigned int devcon_screen_get_width(struct devcon_screen *screen);
 unsigned int devcon_screen_get_height(struct devcon_screen *screen);
 u64 devcon_screen_get_age(struct devcon_screen *screen);
+const u8 *devcon_screen_get_palette(struct devcon_screen *screen);
+bool devcon_screen_is_blinking(struct devcon_screen *screen);
+bool devcon_screen_blink(struct devcon_screen *screen);
+size_t devcon_screen_get_size(struct devcon_screen *screen);
+size_t devcon_screen_get_reclaimable(struct devcon_screen *screen,
+				     unsigned int floor);
+size_t devcon_screen_shrink(struct devcon_screen *screen,
+			    unsigned int floor,
+			    size_t target,
+			    gfp_t gfp);
+void devcon_screen_export(struct devcon_screen *screen,
+			  struct seq_file *m,
+			  time64_t since);
 
 int devcon_screen_feed_text(struct devcon_screen *screen,
 			    const u8 *in,
@@ -61,15 +89,12 @@ void devcon_screen_hard_reset(struct devcon_screen *screen);
 int devcon_screen_set_answerback(struct devcon_screen *screen,
 				 const char *answerback);
 
+void devcon_screen_save(struct devcon_screen *screen, struct devcon_stream *s);
+int devcon_screen_load(struct devcon_screen *screen, struct devcon_stream *s);
+
 int devcon_screen_draw(struct devcon_screen *screen,
-		       int (*draw_fn) (struct devcon_screen *screen,
-				       void *userdata,
-				       unsigned int x,
-				       unsigned int y,
-				       const struct devcon_attr *attr,
-				       const u32 *ch,
-				       size_t n_ch,
-				       unsigned int ch_width),
+		       devcon_screen_draw_fn draw_fn,
+		       devcon_screen_fill_fn fill_fn,
 		       void *userdata,
 		       u64 *fb_age);
 
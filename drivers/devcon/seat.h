@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2015 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * devcon is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ */
+
+#ifndef __DEVCON_SEAT_H
+#define __DEVCON_SEAT_H
+
+#include <linux/kernel.h>
+
+/*
+ * Seats
+ * A seat is a group of input devices and displays used by a single person.
+ * Seats are identified by their index. Every input device and every display
+ * starts out on seat 0 and can be reassigned at runtime via debugfs. Input
+ * handlers only see events of devices on their seat, video handlers only draw
+ * on displays of their seat.
+ */
+
+#define DEVCON_SEAT_MAX 8
+
+#endif /* __DEVCON_SEAT_H */
@@ -9,20 +9,33 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 #include <linux/atomic.h>
+#include <linux/debugfs.h>
 #include <linux/input.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/shrinker.h>
 #include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
+#include "holder.h"
 #include "input.h"
 #include "screen.h"
+#include "seat.h"
 #include "terminal.h"
 #include "tty.h"
 #include "video.h"
 
 /*
  * Terminal Management
+ * There is one terminal per seat. Each terminal manages its own set of
+ * windows, and binds its input and video handlers to its seat. The global
+ * hotkey is routed to the terminal of the seat that produced the most recent
+ * key event.
  */
 
 struct devcon_window {
@@ -46,6 +59,9 @@ enum {
 
 struct devcon_terminal {
 	struct mutex lock;
+	struct work_struct work;
+	struct delayed_work blink;
+	unsigned int seat;
 	struct devcon_input_handler input;
 	struct devcon_video_handler video;
 	struct list_head windows;
@@ -59,9 +75,20 @@ struct devcon_terminal {
 };
 
 static void devcon_terminal_worker(struct work_struct *work);
+static void devcon_terminal_blinker(struct work_struct *work);
 
-static struct devcon_terminal *devcon_terminal_glob;
-static DECLARE_WORK(devcon_terminal_work, devcon_terminal_worker);
+static unsigned int devcon_terminal_blink_ms = 500;
+module_param_named(blink_interval_ms, devcon_terminal_blink_ms, uint, 0644);
+MODULE_PARM_DESC(blink_interval_ms, "Blink interval in ms (0 to disable)");
+
+static unsigned int devcon_terminal_history_floor = 256;
+module_param_named(history_floor, devcon_terminal_history_floor, uint, 0644);
+MODULE_PARM_DESC(history_floor,
+		 "Scrollback lines kept per window under memory pressure");
+
+static struct devcon_terminal *devcon_terminals[DEVCON_SEAT_MAX];
+static struct workqueue_struct *devcon_terminal_wq;
+static bool devcon_terminal_shrinking;
 
 static int devcon_window_tty_output(struct devcon_screen *screen,
 				    void *userdata,
@@ -122,10 +149,34 @@ static int devcon_window_draw_cell(struct devcon_screen *screen,
 {
 	struct devcon_display *display = userdata;
 	unsigned int i;
+	bool underline;
+	u8 fg, bg;
+
+	devcon_attr_to_vga(attr, &fg, &bg);
+
+	underline = attr->underline && !attr->hidden;
 
-	devcon_video_draw_glyph(display, ch[0], x, y);
+	devcon_video_draw_glyph(display, ch[0], x, y, fg, bg, underline);
 	for (i = 1; i < cwidth; ++i)
-		devcon_video_draw_glyph(display, 0, x, y);
+		devcon_video_draw_glyph(display, 0, x + i, y, fg, bg,
+					underline);
+
+	return 0;
+}
+
+static int devcon_window_draw_fill(struct devcon_screen *screen,
+				   void *userdata,
+				   unsigned int x,
+				   unsigned int y,
+				   unsigned int width,
+				   unsigned int height,
+				   const struct devcon_attr *attr)
+{
+	struct devcon_display *display = userdata;
+	u8 fg, bg;
+
+	devcon_attr_to_vga(attr, &fg, &bg);
+	devcon_video_draw_fill(display, x, y, width, height, bg);
 
 	return 0;
 }
@@ -136,15 +187,32 @@ static void devcon_window_draw(struct devcon_video_handler *video,
 	struct devcon_window *window = container_of(video,
 						    struct devcon_window,
 						    video);
+	u8 rgb[DEVCON_VIDEO_COLORS * 3];
+
+	BUILD_BUG_ON(DEVCON_VIDEO_COLORS != DEVCON_PALETTE_N);
 
 	if (WARN_ON(!window->raised))
 		return;
 
 	mutex_lock(&window->lock);
+
+	/* cells using colors changed via OSC were aged by the screen */
+	devcon_palette_to_vga(devcon_screen_get_palette(window->screen), rgb);
+	devcon_video_set_palette(display, rgb);
+
 	devcon_screen_draw(window->screen,
 			   devcon_window_draw_cell,
+			   devcon_window_draw_fill,
 			   display,
-			   NULL);
+			   devcon_video_get_age(display, video));
+
+	/*
+	 * The blink timer is only ever armed from here, so it stops on its own
+	 * if nothing is drawn anymore (eg., because all displays are blanked).
+	 */
+	if (devcon_terminal_blink_ms && devcon_screen_is_blinking(window->screen))
+		queue_delayed_work(devcon_terminal_wq, &window->terminal->blink,
+				   msecs_to_jiffies(devcon_terminal_blink_ms));
 	mutex_unlock(&window->lock);
 }
 
@@ -181,8 +249,10 @@ static int devcon_window_new(struct devcon_window **out,
 	mutex_init(&window->lock);
 	devcon_input_init_handler(&window->input);
 	window->input.event = devcon_window_input;
+	window->input.seat = t->seat;
 	devcon_video_init_handler(&window->video);
 	window->video.draw = devcon_window_draw;
+	window->video.seat = t->seat;
 
 	ret = devcon_screen_new(&window->screen,
 				devcon_window_tty_output,
@@ -196,6 +266,12 @@ static int devcon_window_new(struct devcon_window **out,
 	if (ret < 0)
 		goto error;
 
+	/* we paint every cell of the screen, so hide anything below */
+	devcon_video_set_region(&window->video, 0, 0,
+				devcon_screen_get_width(window->screen),
+				devcon_screen_get_height(window->screen),
+				true);
+
 	ret = devcon_tty_new(&window->tty, devcon_window_tty_input, window);
 	if (ret < 0)
 		goto error;
@@ -250,14 +326,14 @@ static bool devcon_terminal_input(struct devcon_input_handler *input,
 	case KEY_H:
 		if (event->mods & DEVCON_MOD_META) {
 			atomic_set(&t->operation, DEVCON_OP_HIDE);
-			schedule_work(&devcon_terminal_work);
+			queue_work(devcon_terminal_wq, &t->work);
 			return true;
 		}
 		break;
 	case KEY_Q:
 		if (event->mods & DEVCON_MOD_META) {
 			atomic_set(&t->operation, DEVCON_OP_QUIT);
-			schedule_work(&devcon_terminal_work);
+			queue_work(devcon_terminal_wq, &t->work);
 			return true;
 		}
 		break;
@@ -269,10 +345,19 @@ static bool devcon_terminal_input(struct devcon_input_handler *input,
 static void devcon_terminal_draw(struct devcon_video_handler *video,
 				 struct devcon_display *display)
 {
+	u64 *age = devcon_video_get_age(display, video);
+
+	/* the background is static, so it only needs to be drawn once */
+	if (age && *age)
+		return;
+
 	devcon_video_draw_clear(display, 0, 0, -1, -1);
+	if (age)
+		*age = 1;
 }
 
-static int devcon_terminal_new(struct devcon_terminal **out)
+static int devcon_terminal_new(struct devcon_terminal **out,
+			       unsigned int seat)
 {
 	struct devcon_terminal *t;
 
@@ -281,10 +366,15 @@ static int devcon_terminal_new(struct devcon_terminal **out)
 		return -ENOMEM;
 
 	mutex_init(&t->lock);
+	INIT_WORK(&t->work, devcon_terminal_worker);
+	INIT_DELAYED_WORK(&t->blink, devcon_terminal_blinker);
+	t->seat = seat;
 	devcon_input_init_handler(&t->input);
 	t->input.event = devcon_terminal_input;
+	t->input.seat = seat;
 	devcon_video_init_handler(&t->video);
 	t->video.draw = devcon_terminal_draw;
+	t->video.seat = seat;
 	INIT_LIST_HEAD(&t->windows);
 	atomic_set(&t->dead, 0);
 
@@ -309,7 +399,7 @@ static void devcon_terminal_show(struct devcon_terminal *t)
 	if (t->shown || !t->running || atomic_read(&t->dead))
 		return;
 
-	pr_info("show terminal\n");
+	pr_info("show terminal on seat %u\n", t->seat);
 	t->shown = true;
 
 	devcon_video_open(&t->video);
@@ -330,7 +420,7 @@ static void devcon_terminal_hide(struct devcon_terminal *t)
 	devcon_video_close(&t->video);
 
 	t->shown = false;
-	pr_info("hide terminal\n");
+	pr_info("hide terminal on seat %u\n", t->seat);
 }
 
 static int devcon_terminal_start(struct devcon_terminal *t)
@@ -385,12 +475,10 @@ static void devcon_terminal_stop(struct devcon_terminal *t, bool kill)
 
 static void devcon_terminal_worker(struct work_struct *work)
 {
-	struct devcon_terminal *t = devcon_terminal_glob;
+	struct devcon_terminal *t = container_of(work, struct devcon_terminal,
+						 work);
 	int ret, op;
 
-	if (WARN_ON(!t))
-		return;
-
 	mutex_lock(&t->lock);
 	if (atomic_read(&t->dead)) {
 		/* Either the terminal is already dead and stopped, or a force
@@ -426,13 +514,298 @@ static void devcon_terminal_worker(struct work_struct *work)
 	mutex_unlock(&t->lock);
 }
 
+static void devcon_terminal_blinker(struct work_struct *work)
+{
+	struct devcon_terminal *t = container_of(to_delayed_work(work),
+						 struct devcon_terminal,
+						 blink);
+	struct devcon_window *window;
+
+	mutex_lock(&t->lock);
+	window = t->active;
+	if (t->shown && window && window->raised) {
+		mutex_lock(&window->lock);
+		if (devcon_screen_blink(window->screen))
+			devcon_video_dirty(&window->video);
+		mutex_unlock(&window->lock);
+	}
+	mutex_unlock(&t->lock);
+}
+
+/*
+ * Memory Shrinker
+ * Under memory pressure, windows release their scrollback down to a floor,
+ * the unused capacity of history lines, and unused alternate screens. All
+ * counts are in bytes. The shrinker might be called by an allocation done
+ * with a terminal or window locked, so locks are only ever tried. Busy
+ * windows are skipped and reclaimed on the next call.
+ */
+
+static size_t devcon_terminal_reclaim(size_t target, gfp_t gfp)
+{
+	struct devcon_window *window;
+	struct devcon_terminal *t;
+	unsigned int i;
+	size_t size = 0;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		t = devcon_terminals[i];
+		if (!t || !mutex_trylock(&t->lock))
+			continue;
+
+		list_for_each_entry(window, &t->windows, list) {
+			if (!mutex_trylock(&window->lock))
+				continue;
+
+			if (target)
+				size += devcon_screen_shrink(window->screen,
+						devcon_terminal_history_floor,
+						target - min(size, target),
+						gfp);
+			else
+				size += devcon_screen_get_reclaimable(
+						window->screen,
+						devcon_terminal_history_floor);
+
+			mutex_unlock(&window->lock);
+		}
+
+		mutex_unlock(&t->lock);
+	}
+
+	return size;
+}
+
+static unsigned long devcon_terminal_count(struct shrinker *shrinker,
+					   struct shrink_control *sc)
+{
+	return devcon_terminal_reclaim(0, 0);
+}
+
+static unsigned long devcon_terminal_scan(struct shrinker *shrinker,
+					  struct shrink_control *sc)
+{
+	size_t size;
+
+	size = devcon_terminal_reclaim(sc->nr_to_scan,
+				       GFP_NOWAIT | __GFP_NOWARN);
+
+	return size ? size : SHRINK_STOP;
+}
+
+static struct shrinker devcon_terminal_shrinker = {
+	.count_objects = devcon_terminal_count,
+	.scan_objects = devcon_terminal_scan,
+	.seeks = DEFAULT_SEEKS,
+	.batch = PAGE_SIZE,
+};
+
+/*
+ * State Preservation
+ * If the devcon_holder module is loaded, the state of all windows is
+ * serialized on unload and restored on the next load. TTYs cannot be
+ * preserved, but unloading requires them to be closed, anyway. The state
+ * starts with a header, followed by each terminal with its windows.
+ */
+
+#define DEVCON_TERMINAL_STATE_MAGIC	0x6e6f6364 /* "dcon" */
+#define DEVCON_TERMINAL_STATE_VERSION	2
+
+enum {
+	DEVCON_TERMINAL_STATE_RUNNING	= (1U << 0),
+	DEVCON_TERMINAL_STATE_SHOWN	= (1U << 1),
+};
+
+static void devcon_terminal_save(struct devcon_stream *s)
+{
+	struct devcon_window *window;
+	struct devcon_terminal *t;
+	u32 n, active, flags;
+	unsigned int i;
+
+	devcon_stream_write_u32(s, DEVCON_TERMINAL_STATE_MAGIC);
+	devcon_stream_write_u32(s, DEVCON_TERMINAL_STATE_VERSION);
+	devcon_stream_write_u32(s, DEVCON_SEAT_MAX);
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		t = devcon_terminals[i];
+		n = 0;
+		active = U32_MAX;
+		flags = 0;
+
+		if (t) {
+			mutex_lock(&t->lock);
+			list_for_each_entry(window, &t->windows, list) {
+				if (window == t->active)
+					active = n;
+				++n;
+			}
+			if (t->running)
+				flags |= DEVCON_TERMINAL_STATE_RUNNING;
+			if (t->shown)
+				flags |= DEVCON_TERMINAL_STATE_SHOWN;
+		}
+
+		devcon_stream_write_u32(s, n);
+		devcon_stream_write_u32(s, active);
+		devcon_stream_write_u32(s, flags);
+
+		if (!t)
+			continue;
+
+		list_for_each_entry(window, &t->windows, list) {
+			mutex_lock(&window->lock);
+			devcon_screen_save(window->screen, s);
+			mutex_unlock(&window->lock);
+		}
+
+		mutex_unlock(&t->lock);
+	}
+}
+
+static int devcon_terminal_load(struct devcon_terminal *t,
+				struct devcon_stream *s)
+{
+	struct devcon_window *window, *active = NULL;
+	u32 i, n, active_idx, flags;
+	int ret;
+
+	ret = devcon_stream_read_u32(s, &n) ?:
+	      devcon_stream_read_u32(s, &active_idx) ?:
+	      devcon_stream_read_u32(s, &flags);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&t->lock);
+
+	for (i = 0; i < n; ++i) {
+		ret = devcon_window_new(&window, t);
+		if (ret < 0)
+			break;
+
+		mutex_lock(&window->lock);
+		ret = devcon_screen_load(window->screen, s);
+		if (ret < 0)
+			devcon_screen_hard_reset(window->screen);
+		devcon_video_set_region(&window->video, 0, 0,
+				devcon_screen_get_width(window->screen),
+				devcon_screen_get_height(window->screen),
+				true);
+		mutex_unlock(&window->lock);
+
+		if (i == active_idx)
+			active = window;
+		if (ret < 0)
+			break;
+	}
+
+	if (!list_empty(&t->windows) &&
+	    (flags & DEVCON_TERMINAL_STATE_RUNNING) && !atomic_read(&t->dead)) {
+		devcon_input_open(&t->input);
+		t->running = true;
+		t->active = active ? : list_first_entry(&t->windows,
+							struct devcon_window,
+							list);
+
+		/*
+		 * Terminals are always restored hidden, even if they were
+		 * shown before the reload. Showing them attaches to all
+		 * displays, which is left to the next hotkey press, rather
+		 * than done during module initialization.
+		 */
+	}
+
+	mutex_unlock(&t->lock);
+
+	return ret;
+}
+
+/**
+ * devcon_terminal_preserve() - Preserve terminal state across a reload
+ *
+ * This serializes all windows of all terminals and hands them to the
+ * devcon_holder module, if it is loaded. It must be called right before
+ * devcon_terminal_destroy() on module unload. The next call to
+ * devcon_terminal_init() restores the state.
+ */
+void devcon_terminal_preserve(void)
+{
+	void (*store)(void *, size_t);
+	struct devcon_stream s = {};
+	size_t size;
+
+	store = symbol_get(devcon_holder_store);
+	if (!store)
+		return;
+
+	/* first pass only calculates the size */
+	devcon_terminal_save(&s);
+	size = s.pos;
+
+	s.data = vmalloc(size);
+	if (s.data) {
+		s.size = size;
+		s.pos = 0;
+		devcon_terminal_save(&s);
+		if (s.pos != size) {
+			/* content changed in between passes; drop it */
+			vfree(s.data);
+			s.data = NULL;
+		}
+	}
+
+	if (s.data)
+		pr_info("preserved %zu bytes of terminal state\n", size);
+	else
+		pr_warn("cannot preserve terminal state\n");
+
+	store(s.data, size);
+	symbol_put(devcon_holder_store);
+}
+
+static void devcon_terminal_restore(void)
+{
+	void *(*take)(size_t *);
+	struct devcon_stream s = {};
+	u32 magic, version, n;
+	unsigned int i;
+	int ret;
+
+	take = symbol_get(devcon_holder_take);
+	if (!take)
+		return;
+
+	s.data = take(&s.size);
+	symbol_put(devcon_holder_take);
+	if (!s.data)
+		return;
+
+	ret = devcon_stream_read_u32(&s, &magic) ?:
+	      devcon_stream_read_u32(&s, &version) ?:
+	      devcon_stream_read_u32(&s, &n);
+	if (!ret && (magic != DEVCON_TERMINAL_STATE_MAGIC ||
+		     version != DEVCON_TERMINAL_STATE_VERSION))
+		ret = -EINVAL;
+
+	for (i = 0; !ret && i < min_t(u32, n, DEVCON_SEAT_MAX); ++i)
+		ret = devcon_terminal_load(devcon_terminals[i], &s);
+
+	if (ret < 0)
+		pr_warn("cannot restore terminal state: %d\n", ret);
+	else
+		pr_info("restored %zu bytes of terminal state\n", s.size);
+
+	vfree(s.data);
+}
+
 /**
  * devcon_terminal_hotkey() - Invoke terminal hotkey handlers
  *
  * This needs to be called whenever the global hotkey is pressed. It will
  * schedule a handler will performs the configured hotkey actions. Note that we
  * only support a single global hotkey, hence, there's no need to tell which
- * hotkey was invoked.
+ * hotkey was invoked. The hotkey applies to the terminal of the seat that
+ * produced the most recent key event.
  *
  * The caller is responsible to call this only if the terminal layer is active.
  * Hence, if you call devcon_terminal_destroy(), you must not invoke the hotkey
@@ -442,57 +815,230 @@ static void devcon_terminal_worker(struct work_struct *work)
  */
 void devcon_terminal_hotkey(void)
 {
-	schedule_work(&devcon_terminal_work);
+	struct devcon_terminal *t;
+
+	t = devcon_terminals[devcon_input_get_active_seat()];
+	if (t)
+		queue_work(devcon_terminal_wq, &t->work);
+}
+
+/*
+ * The debugfs file lists all windows as "<seat> <index> <width>x<height>
+ * <bytes>", where <bytes> is the memory used by the window's screen.
+ */
+static int devcon_terminal_debugfs_show(struct seq_file *m, void *v)
+{
+	struct devcon_window *window;
+	struct devcon_terminal *t;
+	unsigned int i, n;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		t = devcon_terminals[i];
+		if (!t)
+			continue;
+
+		n = 0;
+		mutex_lock(&t->lock);
+		list_for_each_entry(window, &t->windows, list) {
+			mutex_lock(&window->lock);
+			seq_printf(m, "%u %u %ux%u %zu\n", t->seat, n++,
+				   devcon_screen_get_width(window->screen),
+				   devcon_screen_get_height(window->screen),
+				   devcon_screen_get_size(window->screen));
+			mutex_unlock(&window->lock);
+		}
+		mutex_unlock(&t->lock);
+	}
+
+	return 0;
+}
+
+static int devcon_terminal_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, devcon_terminal_debugfs_show, NULL);
 }
 
+static const struct file_operations devcon_terminal_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= devcon_terminal_debugfs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * The scrollback file exports the scrollback buffers of all windows. Each
+ * window starts with a "# <seat> <index>" header, followed by its lines as
+ * "<time> <text>", where <time> is the time the line was scrolled off, in
+ * seconds since the epoch. Writing a time to the file restricts the export
+ * to lines scrolled off at, or after, that time. Write 0 to export everything.
+ */
+static time64_t devcon_terminal_scrollback_since;
+
+static int devcon_terminal_scrollback_show(struct seq_file *m, void *v)
+{
+	struct devcon_window *window;
+	struct devcon_terminal *t;
+	unsigned int i, n;
+	time64_t since;
+
+	since = ACCESS_ONCE(devcon_terminal_scrollback_since);
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		t = devcon_terminals[i];
+		if (!t)
+			continue;
+
+		n = 0;
+		mutex_lock(&t->lock);
+		list_for_each_entry(window, &t->windows, list) {
+			mutex_lock(&window->lock);
+			seq_printf(m, "# %u %u\n", t->seat, n++);
+			devcon_screen_export(window->screen, m, since);
+			mutex_unlock(&window->lock);
+		}
+		mutex_unlock(&t->lock);
+	}
+
+	return 0;
+}
+
+static int devcon_terminal_scrollback_open(struct inode *inode,
+					   struct file *file)
+{
+	return single_open(file, devcon_terminal_scrollback_show, NULL);
+}
+
+static ssize_t devcon_terminal_scrollback_write(struct file *file,
+						const char __user *ubuf,
+						size_t size,
+						loff_t *off)
+{
+	long long since;
+	char buf[32];
+
+	if (size >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, size))
+		return -EFAULT;
+
+	buf[size] = 0;
+	if (sscanf(buf, "%lld", &since) != 1)
+		return -EINVAL;
+
+	ACCESS_ONCE(devcon_terminal_scrollback_since) = since;
+
+	return size;
+}
+
+static const struct file_operations devcon_terminal_scrollback_fops = {
+	.owner		= THIS_MODULE,
+	.open		= devcon_terminal_scrollback_open,
+	.read		= seq_read,
+	.write		= devcon_terminal_scrollback_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /**
  * devcon_terminal_init() - Initialize the terminal layer
+ * @debugfs: debugfs directory to add files to, or NULL
  *
  * This prepares the terminal layer and allocates required resources. The
- * initial terminal state tracking is set up, but it is not activated. Use the
- * hotkey handler devcon_terminal_hotkey() to invoke the terminal.
+ * initial terminal state tracking is set up for each seat, but it is not
+ * activated. Use the hotkey handler devcon_terminal_hotkey() to invoke the
+ * terminal.
  */
-int devcon_terminal_init(void)
+int devcon_terminal_init(struct dentry *debugfs)
 {
+	unsigned int i;
 	int ret;
 
-	if (WARN_ON(devcon_terminal_glob))
+	if (WARN_ON(devcon_terminals[0]))
 		return -EINVAL;
 
-	ret = devcon_terminal_new(&devcon_terminal_glob);
+	/*
+	 * Terminal workers handle input and echo, so they must not queue
+	 * behind unrelated work. The queue is unbound, and its cpumask can be
+	 * changed via sysfs to keep them off isolated CPUs.
+	 */
+	devcon_terminal_wq = alloc_workqueue("devcon_terminal",
+					     WQ_HIGHPRI | WQ_UNBOUND | WQ_SYSFS,
+					     0);
+	if (!devcon_terminal_wq)
+		return -ENOMEM;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		ret = devcon_terminal_new(&devcon_terminals[i], i);
+		if (ret < 0)
+			goto error;
+	}
+
+	ret = register_shrinker(&devcon_terminal_shrinker);
 	if (ret < 0)
-		return ret;
+		goto error;
+
+	devcon_terminal_shrinking = true;
+
+	if (debugfs) {
+		debugfs_create_file("windows", S_IRUSR, debugfs, NULL,
+				    &devcon_terminal_debugfs_fops);
+		debugfs_create_file("scrollback", S_IRUSR | S_IWUSR, debugfs,
+				    NULL, &devcon_terminal_scrollback_fops);
+	}
+
+	devcon_terminal_restore();
 
 	return 0;
+
+error:
+	devcon_terminal_destroy();
+	return ret;
 }
 
 /**
  * devcon_terminal_destroy() - Cleanup the terminal layer
  *
  * This reverts the effect of devcon_terminal_init() and destroys the terminal
- * layer. If the terminal is active, it's deactivated and disabled. Any
+ * layer. If a terminal is active, it's deactivated and disabled. Any
  * allocated resources are then released.
  */
 void devcon_terminal_destroy(void)
 {
-	struct devcon_terminal *t = devcon_terminal_glob;
-
-	if (!t)
-		return;
+	struct devcon_terminal *t;
+	unsigned int i;
 
 	/*
-	 * We force-stop the terminal first. It is then marked as dead and will
+	 * We force-stop each terminal first. It is then marked as dead and will
 	 * not schedule any operations, anymore. Any further call to
 	 * devcon_terminal_start() will be rejected.
 	 * We then synchronously wait for a possible worker to finish (the
 	 * worker will not have any effect as the terminal is marked as dead)
-	 * before destroying the terminal resources.
+	 * before destroying the terminal resources. The shrinker is removed
+	 * upfront, as it accesses the terminals without holding a reference.
 	 */
 
-	mutex_lock(&t->lock);
-	devcon_terminal_stop(t, true);
-	mutex_unlock(&t->lock);
+	if (devcon_terminal_shrinking) {
+		unregister_shrinker(&devcon_terminal_shrinker);
+		devcon_terminal_shrinking = false;
+	}
 
-	cancel_work_sync(&devcon_terminal_work);
-	devcon_terminal_glob = devcon_terminal_free(t);
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i) {
+		t = devcon_terminals[i];
+		if (!t)
+			continue;
+
+		mutex_lock(&t->lock);
+		devcon_terminal_stop(t, true);
+		mutex_unlock(&t->lock);
+
+		cancel_work_sync(&t->work);
+		cancel_delayed_work_sync(&t->blink);
+		devcon_terminals[i] = devcon_terminal_free(t);
+	}
+
+	if (devcon_terminal_wq) {
+		destroy_workqueue(devcon_terminal_wq);
+		devcon_terminal_wq = NULL;
+	}
 }
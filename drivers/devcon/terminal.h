@@ -12,8 +12,11 @@
 
 #include <linux/kernel.h>
 
-int devcon_terminal_init(void);
+struct dentry;
+
+int devcon_terminal_init(struct dentry *debugfs);
 void devcon_terminal_destroy(void);
+void devcon_terminal_preserve(void);
 
 void devcon_terminal_hotkey(void);
 
@@ -9,54 +9,241 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 #include <linux/console.h>
+#include <linux/debugfs.h>
 #include <linux/fb.h>
+#include <linux/firmware.h>
 #include <linux/font.h>
+#include <linux/kd.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/vt_kern.h>
 #include <linux/workqueue.h>
+#include "seat.h"
 #include "video.h"
 
 /*
  * Video Handling
+ * Each display is bound to a seat, and video handlers are kept on per-seat
+ * lists. A display is only ever drawn to by the handlers of its own seat, and
+ * is released as soon as its seat has no handlers left.
+ *
+ * Displays are attached lazily. At load time, only the fb-notifier is
+ * registered. The first time a handler is opened, the worker attaches to all
+ * framebuffers. Once no handler is left, the displays are detached again
+ * after an idle timeout, so compositors get exclusive access back.
+ *
+ * Handlers are stacked in the order they were opened. Each handler declares
+ * the region (in cells) it draws to, and whether it is opaque. Handlers that
+ * are fully covered by an opaque handler above them are skipped, and drawing
+ * operations of lower handlers are clipped against opaque handlers above.
+ *
+ * Each display tracks, for each handler, the age of the content that handler
+ * last drew on it (see devcon_video_get_age()). The ages are reset whenever
+ * the content is lost, or a lower handler painted over it. On release, the
+ * last rendered frame is saved, so if the mode is unchanged when the display
+ * is taken over again, a single blit restores it and handlers only need to
+ * draw what changed in between.
+ *
+ * Similarly, the content of the previous user (usually a compositor) is saved
+ * when a display is taken over, and written back when it is released. Both
+ * copies, like all other fbdev accesses, are done with the console lock held.
+ * The fbdev ioctls take it before the fb_info lock and before calling into our
+ * notifier, so it serializes them against us and the lock order is safe.
+ *
+ * While a display is taken over, the VT that fbcon shows on it is switched to
+ * graphics mode, so kernel and VT output is not rendered into our frame. The
+ * framebuffer itself stays running. Once the display is released, the VT is
+ * switched back and fbcon repaints it, instead of the backup being written
+ * back.
+ *
+ * Additionally, each display caches what is visible in each cell (glyph,
+ * colors and underline). Ages are coarse (a page-wide age bump forces all
+ * cells to be redrawn), so drawing operations compare against this cache and
+ * skip cells that would not change visibly. The cache is dropped together
+ * with the ages whenever the content is lost.
+ *
+ * Text is drawn with the kernel bitmap fonts, unless a glyph atlas with 8-bit
+ * alpha values is loaded as firmware (see the "font" parameter). Atlas glyphs
+ * are blended via per-display tables of the 256 pixel values between each
+ * pair of foreground and background colors. A table is computed the first
+ * time its color pair is drawn, and dropped together with the cell cache.
+ *
+ * Handlers signal new content via devcon_video_dirty(), which is called from
+ * the parse path for every write. Hence, it never takes a lock: each handler
+ * has a dirty bit, and only the handler that sets it queues itself on a
+ * lock-less list. The worker is scheduled once the list turns non-empty, and
+ * clears the bits of all handlers it collects before drawing them.
+ *
+ * A seat is headless if we're attached, but none of its displays can show
+ * anything (there are none, or all are blanked or suspended). Handlers of
+ * headless seats are never marked dirty, so writes to their windows cause no
+ * rendering work at all. Any display that becomes usable again is fully
+ * redrawn, anyway.
+ */
+
+struct devcon_video_snapshot {
+	struct fb_var_screeninfo var;
+	void *data;
+	size_t size;			/* size of the saved region */
+	size_t length;			/* allocated size of @data */
+	bool compressed : 1;
+};
+
+#define DEVCON_VIDEO_CLIP_MAX 8
+
+/* bits of devcon_video_handler.flags */
+#define DEVCON_VIDEO_HANDLER_DIRTY	0
+
+#define DEVCON_VIDEO_CELL_VALID		0x01
+#define DEVCON_VIDEO_CELL_UNDERLINE	0x02
+
+/*
+ * A glyph atlas starts with this header, followed by 256 glyphs in code page
+ * order. Each glyph is @height rows of @width alpha values, one byte each.
  */
+#define DEVCON_ATLAS_MAGIC		0x41464344	/* "DCFA" */
+#define DEVCON_ATLAS_GLYPHS		256
+
+struct devcon_atlas_header {
+	__le32 magic;
+	__le16 width;
+	__le16 height;
+};
+
+struct devcon_video_cell {
+	u8 glyph;
+	u8 fg;
+	u8 bg;
+	u8 flags;
+};
+
+struct devcon_video_age {
+	struct list_head list;
+	u64 id;
+	u64 age;
+};
 
 struct devcon_display {
 	struct list_head list;
 	struct list_head schedule;
+	struct list_head ages;
 
 	struct fb_info *fbinfo;
 	const struct font_desc *font;
 	unsigned int width;
 	unsigned int height;
-
+	unsigned int seat;
+
+	struct devcon_video_rect damage;
+	struct devcon_video_rect clip[DEVCON_VIDEO_CLIP_MAX];
+	unsigned int n_clip;
+	struct devcon_video_cell *cells;	/* width * height, or NULL */
+	u32 *blend[DEVCON_VIDEO_COLORS * DEVCON_VIDEO_COLORS];
+	void *glyph;			/* bounce buffer for atlas glyphs */
+	u8 rgb[DEVCON_VIDEO_COLORS * 3];
+	u32 palette[DEVCON_VIDEO_COLORS];	/* @rgb as native pixels */
+
+	struct fb_var_screeninfo mode;
+	struct devcon_video_snapshot frame;
+	struct devcon_video_snapshot backup;
+	unsigned int vt;		/* VT in graphics mode, if @exclusive */
+
+	bool has_mode : 1;
+	bool need_backup : 1;
+	bool need_handback : 1;
 	bool need_mode : 1;
 	bool need_redraw : 1;
 	bool suspended : 1;
 	bool blanked : 1;
+	bool exclusive : 1;		/* fbcon rendering is stopped */
+	bool alpha : 1;			/* @font is the glyph atlas */
+	bool has_palette : 1;		/* @rgb was set by a handler */
 };
 
 static void devcon_video_worker(struct work_struct *work);
+static void devcon_video_idle_worker(struct work_struct *work);
+static bool devcon_display_claim(struct devcon_display *d);
+static bool devcon_display_release_vt(struct devcon_display *d);
+
+static unsigned int devcon_video_idle_ms = 30000;
+module_param_named(idle_timeout_ms, devcon_video_idle_ms, uint, 0644);
+MODULE_PARM_DESC(idle_timeout_ms,
+		 "Time in ms to keep displays attached while hidden");
+
+static bool devcon_video_compress;
+module_param_named(compress_backup, devcon_video_compress, bool, 0644);
+MODULE_PARM_DESC(compress_backup,
+		 "Compress saved framebuffer content of the previous user");
+
+static char *devcon_video_font;
+module_param_named(font, devcon_video_font, charp, 0444);
+MODULE_PARM_DESC(font, "Firmware file of an 8-bit alpha glyph atlas");
+
+static const struct firmware *devcon_video_atlas_fw;
+static struct font_desc devcon_video_atlas = { .name = "atlas" };
 
 static struct notifier_block devcon_video_notifier;
+static struct workqueue_struct *devcon_video_wq;
 static u64 devcon_video_position_counter;
-static bool devcon_video_running;
+static u64 devcon_video_id_counter;
+static bool devcon_video_attached;
+static bool devcon_video_headless[DEVCON_SEAT_MAX];
+static unsigned int devcon_video_fb_seats[FB_MAX];
 static DECLARE_WORK(devcon_video_work, devcon_video_worker);
+static DECLARE_DELAYED_WORK(devcon_video_idle_work, devcon_video_idle_worker);
 static DEFINE_MUTEX(devcon_video_lock);
-static DEFINE_MUTEX(devcon_video_dirty_lock);
-static LIST_HEAD(devcon_video_handlers);
-static LIST_HEAD(devcon_video_dirty_list);
+static struct list_head devcon_video_handlers[DEVCON_SEAT_MAX];
+static LLIST_HEAD(devcon_video_dirty_list);
 static LIST_HEAD(devcon_displays);
 static LIST_HEAD(devcon_schedule);
 
+static bool devcon_display_is_used(struct devcon_display *d)
+{
+	return !list_empty(&devcon_video_handlers[d->seat]);
+}
+
+/*
+ * Recalculate which seats are headless. Must be called with devcon_video_lock
+ * held whenever displays are added, removed, moved, blanked or suspended. The
+ * result is read lock-less by devcon_video_dirty().
+ */
+static void devcon_video_update_headless(void)
+{
+	bool headless[DEVCON_SEAT_MAX];
+	struct devcon_display *d;
+	unsigned int i;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		headless[i] = devcon_video_attached;
+
+	list_for_each_entry(d, &devcon_displays, list)
+		if (!d->suspended && !d->blanked)
+			headless[d->seat] = false;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		ACCESS_ONCE(devcon_video_headless[i]) = headless[i];
+}
+
 static void devcon_display_schedule(struct devcon_display *d)
 {
 	if (list_empty(&d->schedule))
 		list_add(&d->schedule, &devcon_schedule);
-	if (list_is_singular(&devcon_schedule) && devcon_video_running)
-		schedule_work(&devcon_video_work);
+
+	/*
+	 * Displays on unused seats might be on the list without the worker
+	 * being queued, so it is queued for each display of a used seat.
+	 * This is cheap, as queue_work() is a no-op if it is pending.
+	 */
+	if (devcon_display_is_used(d))
+		queue_work(devcon_video_wq, &devcon_video_work);
 }
 
 static int devcon_display_new(struct devcon_display **out,
@@ -82,7 +269,10 @@ static int devcon_display_new(struct devcon_display **out,
 
 	INIT_LIST_HEAD(&d->list);
 	INIT_LIST_HEAD(&d->schedule);
+	INIT_LIST_HEAD(&d->ages);
 	d->fbinfo = fbinfo;
+	if (fbinfo->node >= 0 && fbinfo->node < FB_MAX)
+		d->seat = devcon_video_fb_seats[fbinfo->node];
 
 	/*
 	 * Our fb-notifier makes sure to drop any displays immediately on
@@ -108,6 +298,7 @@ static int devcon_display_new(struct devcon_display **out,
 
 	/* link and schedule modeset */
 	list_add(&d->list, &devcon_displays);
+	d->need_backup = true;
 	d->need_mode = true;
 	devcon_display_schedule(d);
 
@@ -120,20 +311,374 @@ error:
 	return ret;
 }
 
+/*
+ * Snapshots
+ * Snapshots store the visible region of a framebuffer. They're either stored
+ * raw, or compressed with a simple run-length encoding of 32bit words. The
+ * framebuffer is always accessed in large sequential chunks via a bounce
+ * buffer, as reading from video memory word by word is very slow.
+ *
+ * The compressed stream consists of one block per chunk, each prefixed with
+ * its length in words. A block is a sequence of records, each starting with
+ * a header word. If DEVCON_RLE_RUN is set in the header, a single word
+ * follows that is repeated as often as the remaining header bits say.
+ * Otherwise, the header bits give the number of literal words that follow.
+ */
+
+#define DEVCON_VIDEO_CHUNK (64 * 1024)
+#define DEVCON_RLE_RUN 0x80000000U
+
+static void devcon_snapshot_clear(struct devcon_video_snapshot *s)
+{
+	vfree(s->data);
+	s->data = NULL;
+	s->size = 0;
+	s->length = 0;
+	s->compressed = false;
+}
+
+static ssize_t devcon_rle_encode(u32 *dst,
+				 size_t n_dst,
+				 const u32 *src,
+				 size_t n_src)
+{
+	size_t i = 0, j, o = 0, lit = 0, lit_pos = 0;
+
+	while (i < n_src) {
+		for (j = i + 1; j < n_src && src[j] == src[i]; ++j)
+			/* empty */ ;
+
+		if (j - i >= 3) {
+			if (o + 2 > n_dst)
+				return -ENOSPC;
+
+			dst[o++] = DEVCON_RLE_RUN | (j - i);
+			dst[o++] = src[i];
+			lit = 0;
+			i = j;
+			continue;
+		}
+
+		for ( ; i < j; ++i) {
+			if (o + 1 + !lit > n_dst)
+				return -ENOSPC;
+			if (!lit)
+				lit_pos = o++;
+
+			dst[o++] = src[i];
+			dst[lit_pos] = ++lit;
+		}
+	}
+
+	return o;
+}
+
+static void devcon_rle_decode(u32 *dst,
+			      size_t n_dst,
+			      const u32 *src,
+			      size_t n_src)
+{
+	size_t i = 0, o = 0, n;
+	u32 header, v;
+
+	while (i < n_src && o < n_dst) {
+		header = src[i++];
+		n = min_t(size_t, header & ~DEVCON_RLE_RUN, n_dst - o);
+
+		if (header & DEVCON_RLE_RUN) {
+			if (i >= n_src)
+				break;
+
+			v = src[i++];
+			while (n--)
+				dst[o++] = v;
+		} else {
+			n = min(n, n_src - i);
+			memcpy(dst + o, src + i, n * sizeof(u32));
+			o += n;
+			i += n;
+		}
+	}
+}
+
+static int devcon_snapshot_save_rle(struct devcon_video_snapshot *s,
+				    const char __iomem *src,
+				    size_t size)
+{
+	size_t off, n, o = 0, n_out = size / sizeof(u32);
+	u32 *bounce, *out, *data;
+	ssize_t r;
+	int ret;
+
+	if (size % sizeof(u32))
+		return -EINVAL;
+
+	bounce = kmalloc(DEVCON_VIDEO_CHUNK, GFP_KERNEL);
+	out = vmalloc(size);
+	if (!bounce || !out) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	for (off = 0; off < size; off += n) {
+		n = min_t(size_t, size - off, DEVCON_VIDEO_CHUNK);
+		memcpy_fromio(bounce, src + off, n);
+
+		/* give up if compression does not pay off */
+		if (o + 1 >= n_out) {
+			ret = -ENOSPC;
+			goto exit;
+		}
+
+		r = devcon_rle_encode(out + o + 1, n_out - o - 1,
+				      bounce, n / sizeof(u32));
+		if (r < 0) {
+			ret = r;
+			goto exit;
+		}
+
+		out[o] = r;
+		o += 1 + r;
+	}
+
+	data = vmalloc(o * sizeof(u32));
+	if (!data) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	memcpy(data, out, o * sizeof(u32));
+	devcon_snapshot_clear(s);
+	s->data = data;
+	s->size = size;
+	s->length = o * sizeof(u32);
+	s->compressed = true;
+	ret = 0;
+
+exit:
+	vfree(out);
+	kfree(bounce);
+	return ret;
+}
+
+static int devcon_snapshot_load_rle(struct devcon_video_snapshot *s,
+				    char __iomem *dst)
+{
+	size_t off, n, o = 0, len, n_in = s->length / sizeof(u32);
+	const u32 *in = s->data;
+	u32 *bounce;
+
+	bounce = kmalloc(DEVCON_VIDEO_CHUNK, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	for (off = 0; off < s->size && o < n_in; off += n) {
+		n = min_t(size_t, s->size - off, DEVCON_VIDEO_CHUNK);
+		len = min_t(size_t, in[o], n_in - o - 1);
+		++o;
+
+		memset(bounce, 0, n);
+		devcon_rle_decode(bounce, n / sizeof(u32), in + o, len);
+		memcpy_toio(dst + off, bounce, n);
+		o += len;
+	}
+
+	kfree(bounce);
+	return 0;
+}
+
+static int devcon_snapshot_save(struct devcon_video_snapshot *s,
+				struct fb_info *fbinfo,
+				const char __iomem *src,
+				size_t size,
+				bool compress)
+{
+	if (compress && !devcon_snapshot_save_rle(s, src, size))
+		goto exit;
+
+	if (s->compressed || s->length != size) {
+		devcon_snapshot_clear(s);
+		s->data = vmalloc(size);
+		if (!s->data)
+			return -ENOMEM;
+		s->length = size;
+	}
+
+	memcpy_fromio(s->data, src, size);
+	s->size = size;
+
+exit:
+	s->var = fbinfo->var;
+	return 0;
+}
+
+static int devcon_snapshot_load(struct devcon_video_snapshot *s,
+				char __iomem *dst,
+				size_t size)
+{
+	if (!s->data || s->size != size)
+		return -ENODEV;
+
+	if (s->compressed)
+		return devcon_snapshot_load_rle(s, dst);
+
+	memcpy_toio(dst, s->data, size);
+	return 0;
+}
+
+static void devcon_display_invalidate(struct devcon_display *d)
+{
+	struct devcon_video_age *a;
+	unsigned int i;
+
+	while ((a = list_first_entry_or_null(&d->ages,
+					     struct devcon_video_age, list))) {
+		list_del(&a->list);
+		kfree(a);
+	}
+
+	if (d->cells)
+		memset(d->cells, 0, sizeof(*d->cells) * d->width * d->height);
+
+	/* the palette or pixel format might change until the next recalc */
+	for (i = 0; i < ARRAY_SIZE(d->blend); ++i) {
+		kfree(d->blend[i]);
+		d->blend[i] = NULL;
+	}
+
+	devcon_snapshot_clear(&d->frame);
+}
+
 static struct devcon_display *devcon_display_free(struct devcon_display *d)
 {
 	if (!d)
 		return NULL;
 
+	if (d->exclusive && devcon_display_release_vt(d))
+		do_unblank_screen(1);
 	if (d->fbinfo->fbops->fb_release)
 		d->fbinfo->fbops->fb_release(d->fbinfo, 0);
 
+	devcon_display_invalidate(d);
+	devcon_snapshot_clear(&d->backup);
+	vfree(d->cells);
+	kfree(d->glyph);
 	list_del_init(&d->schedule);
 	list_del_init(&d->list);
 	kfree(d);
 	return NULL;
 }
 
+static bool devcon_display_mode_equal(const struct fb_var_screeninfo *a,
+				      const struct fb_var_screeninfo *b)
+{
+	return a->xres == b->xres &&
+	       a->yres == b->yres &&
+	       a->xres_virtual == b->xres_virtual &&
+	       a->yres_virtual == b->yres_virtual &&
+	       a->xoffset == b->xoffset &&
+	       a->yoffset == b->yoffset &&
+	       a->bits_per_pixel == b->bits_per_pixel &&
+	       a->grayscale == b->grayscale &&
+	       !memcmp(&a->red, &b->red, sizeof(a->red)) &&
+	       !memcmp(&a->green, &b->green, sizeof(a->green)) &&
+	       !memcmp(&a->blue, &b->blue, sizeof(a->blue)) &&
+	       a->rotate == b->rotate;
+}
+
+static char __iomem *devcon_display_get_visible(struct devcon_display *d,
+						size_t *size)
+{
+	struct fb_info *fbinfo = d->fbinfo;
+	size_t offset, length, total;
+
+	if (fbinfo->var.xoffset)
+		return NULL;
+
+	offset = (size_t)fbinfo->var.yoffset * fbinfo->fix.line_length;
+	length = (size_t)fbinfo->var.yres * fbinfo->fix.line_length;
+	total = fbinfo->screen_size ? : fbinfo->fix.smem_len;
+	if (!length || offset + length > total)
+		return NULL;
+
+	*size = length;
+	return fbinfo->screen_base + offset;
+}
+
+static void devcon_display_save_frame(struct devcon_display *d)
+{
+	char __iomem *src;
+	size_t size;
+
+	src = devcon_display_get_visible(d, &size);
+	if (!src || !d->has_mode ||
+	    devcon_snapshot_save(&d->frame, d->fbinfo, src, size, false) < 0)
+		devcon_display_invalidate(d);
+}
+
+static bool devcon_display_load_frame(struct devcon_display *d)
+{
+	char __iomem *dst;
+	size_t size;
+
+	if (!d->frame.data ||
+	    !devcon_display_mode_equal(&d->frame.var, &d->fbinfo->var))
+		return false;
+
+	dst = devcon_display_get_visible(d, &size);
+	if (!dst)
+		return false;
+
+	return devcon_snapshot_load(&d->frame, dst, size) >= 0;
+}
+
+/* save the content of the previous user; caller must lock the fbinfo */
+static void devcon_display_save_backup(struct devcon_display *d)
+{
+	char __iomem *src;
+	size_t size;
+
+	if (!d->need_backup)
+		return;
+
+	d->need_backup = false;
+
+	src = devcon_display_get_visible(d, &size);
+	if (!src || devcon_snapshot_save(&d->backup, d->fbinfo, src, size,
+					 devcon_video_compress) < 0)
+		devcon_snapshot_clear(&d->backup);
+}
+
+/*
+ * Hand a display back to its previous user. Our own frame is saved for the
+ * next takeover, and the content of the previous user is written back.
+ */
+static void devcon_display_handback(struct devcon_display *d)
+{
+	char __iomem *dst;
+	size_t size;
+
+	if (!d->need_handback)
+		return;
+
+	d->need_handback = false;
+
+	if (!lock_fb_info(d->fbinfo))
+		return;
+
+	devcon_display_save_frame(d);
+
+	dst = devcon_display_get_visible(d, &size);
+	if (dst && d->backup.data && !d->suspended && !d->blanked &&
+	    devcon_display_mode_equal(&d->backup.var, &d->fbinfo->var))
+		devcon_snapshot_load(&d->backup, dst, size);
+
+	unlock_fb_info(d->fbinfo);
+
+	devcon_snapshot_clear(&d->backup);
+	d->need_backup = true;
+}
+
 static void devcon_display_clear(struct devcon_display *d)
 {
 	struct fb_fillrect region = {};
@@ -151,12 +696,36 @@ static void devcon_display_clear(struct devcon_display *d)
 	d->fbinfo->fbops->fb_fillrect(d->fbinfo, &region);
 }
 
-static void devcon_display_prepare(struct devcon_display *d)
+/*
+ * Take over the display. If the mode is still the one we last rendered with,
+ * no modeset is done. If, additionally, the last rendered frame is still
+ * around, it is restored and true is returned, meaning the content is valid
+ * and does not need a full redraw. fbcon is stopped before the frame is
+ * restored, so blanking the VT cannot draw over it.
+ * Caller must hold the console lock.
+ */
+static bool devcon_display_prepare(struct devcon_display *d)
 {
 	struct fb_var_screeninfo var;
 
+	/* while shown, fbcon might have painted a newly shown VT over us */
 	if (!d->need_mode)
-		return;
+		return !devcon_display_claim(d);
+
+	d->need_mode = false;
+
+	devcon_display_save_backup(d);
+
+	if (devcon_display_claim(d))
+		d->need_redraw = true;
+
+	if (d->has_mode && devcon_display_mode_equal(&d->mode, &d->fbinfo->var)) {
+		if (!d->need_redraw && devcon_display_load_frame(d))
+			return true;
+
+		devcon_display_clear(d);
+		return false;
+	}
 
 	devcon_display_clear(d);
 
@@ -164,19 +733,178 @@ static void devcon_display_prepare(struct devcon_display *d)
 	var.activate = FB_ACTIVATE_NOW | FB_ACTIVATE_FORCE;
 	fb_set_var(d->fbinfo, &var);
 
-	d->need_mode = false;
+	d->mode = d->fbinfo->var;
+	d->has_mode = true;
+	return false;
+}
+
+/*
+ * Return the VT that fbcon shows on @d, or NULL if there is none. fbcon only
+ * renders the foreground VT, and only on the framebuffer that VT is mapped to.
+ * The console map is private to fbcon, so it is queried via the fb notifier.
+ * Caller must hold the console lock.
+ */
+static struct vc_data *devcon_display_get_vc(struct devcon_display *d)
+{
+	struct fb_con2fbmap map = {};
+	struct fb_event event = {};
+
+	if (!d->fbinfo->fbcon_par)
+		return NULL;
+
+	map.console = fg_console + 1;
+	map.framebuffer = -1;
+	event.info = d->fbinfo;
+	event.data = &map;
+	fb_notifier_call_chain(FB_EVENT_GET_CONSOLE_MAP, &event);
+
+	if ((int)map.framebuffer != d->fbinfo->node)
+		return NULL;
+
+	return vc_cons[fg_console].d;
+}
+
+/*
+ * Switch the VT we put into graphics mode back to text mode. Returns true if it
+ * is the foreground VT, in which case the caller must unblank it, so fbcon
+ * repaints it. Caller must hold the console lock.
+ */
+static bool devcon_display_release_vt(struct devcon_display *d)
+{
+	struct vc_data *vc = vc_cons[d->vt].d;
+
+	d->exclusive = false;
+
+	/* userspace might have changed the mode in between */
+	if (!vc || vc->vc_mode != KD_GRAPHICS)
+		return false;
+
+	vc->vc_mode = KD_TEXT;
+	return d->vt == fg_console;
+}
+
+/*
+ * Keep fbcon from rendering into a display we took over. The VT shown on it is
+ * switched to graphics mode, like compositors do via KDSETMODE, so fbcon stops
+ * drawing without the framebuffer being touched. VTs in graphics mode already
+ * belong to someone else and are left alone.
+ * If the foreground VT changed since the last call, fbcon painted the new VT
+ * over our content. Hence, the old VT is released and true is returned, so the
+ * caller redraws everything. Otherwise, false is returned. Caller must hold the
+ * console lock.
+ */
+static bool devcon_display_claim(struct devcon_display *d)
+{
+	struct vc_data *vc;
+	bool lost = false;
+
+	if (d->exclusive) {
+		if (d->vt == fg_console)
+			return false;
+
+		devcon_display_release_vt(d);
+		lost = true;
+	}
+
+	vc = devcon_display_get_vc(d);
+	if (!vc || vc->vc_mode != KD_TEXT)
+		return lost;
+
+	vc->vc_mode = KD_GRAPHICS;
+	do_blank_screen(1);
+	d->vt = vc->vc_num;
+	d->exclusive = true;
+
+	return lost;
 }
 
+/*
+ * Mark a display for release. The actual handback is done via
+ * devcon_display_handback(), so the caller can release all displays before
+ * writing any content back. However, if fbcon shows a VT on the display, the
+ * backup is stale, so the handback is done right away and fbcon repaints the
+ * display instead. Caller must hold the console lock.
+ */
 static void devcon_display_restore(struct devcon_display *d)
 {
 	if (d->need_mode)
 		return;
 
-	/* TODO: There's no nice way to restore the previous user right now.
-	 *       As a workaround, you should switch VTs to force a full
-	 *       screen redraw (or modeset) of the compositor. */
+	/* TODO: If we had to modeset on takeover, there's no nice way to
+	 *       restore the mode of the previous user right now. Its content
+	 *       is only written back if the mode is unchanged. Otherwise, you
+	 *       should switch VTs to force a full screen redraw (or modeset)
+	 *       of the compositor. */
 
 	d->need_mode = true;
+	d->need_handback = true;
+
+	if (!d->exclusive)
+		return;
+
+	if (devcon_display_release_vt(d)) {
+		/* the VT might be mapped to a different framebuffer */
+		if (devcon_display_get_vc(d)) {
+			devcon_snapshot_clear(&d->backup);
+			devcon_display_handback(d);
+		}
+
+		do_unblank_screen(1);
+	}
+}
+
+/* convert an 8-bit color channel to its bits of a native pixel */
+static u32 devcon_display_pack(u8 v, const struct fb_bitfield *f)
+{
+	if (!f->length || f->length > 16)
+		return 0;
+
+	return ((v * ((1U << f->length) - 1) + 127) / 255) << f->offset;
+}
+
+/*
+ * Convert the palette to native pixel values. Until a handler set a palette,
+ * the pseudo palette of the driver is used, with its light grey and black as
+ * default foreground and background colors.
+ */
+static void devcon_display_update_palette(struct devcon_display *d)
+{
+	const struct fb_var_screeninfo *var = &d->fbinfo->var;
+	const u32 *pseudo = d->fbinfo->pseudo_palette;
+	const u8 *rgb;
+	unsigned int i;
+
+	for (i = 0; i < DEVCON_VIDEO_COLORS; ++i) {
+		rgb = &d->rgb[i * 3];
+		if (d->has_palette)
+			d->palette[i] = devcon_display_pack(rgb[0], &var->red) |
+					devcon_display_pack(rgb[1], &var->green) |
+					devcon_display_pack(rgb[2], &var->blue);
+		else if (pseudo)
+			d->palette[i] = pseudo[i < 16 ? i : (i == 16) ? 7 : 0];
+	}
+}
+
+/*
+ * Atlas glyphs are written to the framebuffer directly, so this requires a
+ * pseudo palette to blend between, and direct access to the visible region.
+ * The bounce buffer for a single glyph is allocated on first use.
+ */
+static bool devcon_display_can_blend(struct devcon_display *d)
+{
+	const struct font_desc *font = &devcon_video_atlas;
+	size_t size;
+
+	if (!font->data || !d->fbinfo->pseudo_palette)
+		return false;
+	if (!devcon_display_get_visible(d, &size))
+		return false;
+
+	if (!d->glyph)
+		d->glyph = kmalloc(font->width * font->height * sizeof(u32),
+				   GFP_KERNEL);
+
+	return d->glyph;
 }
 
 static void devcon_display_recalc(struct devcon_display *d)
@@ -191,6 +919,12 @@ static void devcon_display_recalc(struct devcon_display *d)
 	if (d->fbinfo->var.grayscale != 0)
 		goto error;
 
+	d->alpha = devcon_display_can_blend(d);
+	if (d->alpha) {
+		d->font = &devcon_video_atlas;
+		goto found;
+	}
+
 	/* we only support 8-aligned font widths/heights */
 	d->font = get_default_font(d->fbinfo->var.xres,
 				   d->fbinfo->var.yres,
@@ -207,6 +941,9 @@ static void devcon_display_recalc(struct devcon_display *d)
 			goto error;
 	}
 
+found:
+	devcon_display_update_palette(d);
+
 	/*
 	 * TODO: Right now, DRM drivers do not set
 	 *       d->fbinfo->var.{width,height}, even though they have the
@@ -221,49 +958,214 @@ static void devcon_display_recalc(struct devcon_display *d)
 
 	if (w != d->width || h != d->height) {
 		pr_info("resize fb%d: %ux%u\n", d->fbinfo->node, w, h);
+		vfree(d->cells);
+		d->cells = NULL;
 		d->width = w;
 		d->height = h;
 	}
 
+	/* the cell cache is optional; retry on each recalc if it failed */
+	if (!d->cells)
+		d->cells = vzalloc(sizeof(*d->cells) * w * h);
+
 	return;
 
 error:
+	vfree(d->cells);
+	d->cells = NULL;
 	d->font = NULL;
+	d->alpha = false;
 	d->width = 0;
 	d->height = 0;
 	pr_info("fb%d has incompatible video format\n", d->fbinfo->node);
 }
 
-static void devcon_display_draw(struct devcon_display *d,
-				struct devcon_video_handler *dirty_handler)
+static void devcon_display_reset_age(struct devcon_display *d,
+				     struct devcon_video_handler *h)
 {
-	struct devcon_video_handler *h;
+	struct devcon_video_age *a;
 
-	/* ignore incompatible devices */
-	if (!d->font || !d->width || !d->height)
-		return;
+	list_for_each_entry(a, &d->ages, list) {
+		if (a->id == h->id) {
+			a->age = 0;
+			break;
+		}
+	}
+}
 
-	/*
-	 * We need to run all video-handlers in the registration-order to
-	 * redraw the screen. If @dirty_handler is set, it points to the
-	 * earliest renderer that signaled that it has dirty data. Hence, we
-	 * can skip all handlers previous to it. If @dirty_handler is NULL,
-	 * it means we need to run *all* handlers. This is usually the case
+static void devcon_display_drop_age(struct devcon_display *d,
+				    struct devcon_video_handler *h)
+{
+	struct devcon_video_age *a;
+
+	list_for_each_entry(a, &d->ages, list) {
+		if (a->id == h->id) {
+			list_del(&a->list);
+			kfree(a);
+			break;
+		}
+	}
+}
+
+static void devcon_display_reset_ages(struct devcon_display *d)
+{
+	struct devcon_video_age *a;
+
+	list_for_each_entry(a, &d->ages, list)
+		a->age = 0;
+}
+
+/* clip a rectangle to the display; returns false if empty */
+static bool devcon_display_clip(struct devcon_display *d,
+				struct devcon_video_rect *r)
+{
+	if (r->x >= d->width || r->y >= d->height || !r->width || !r->height)
+		return false;
+
+	r->width = min(r->width, d->width - r->x);
+	r->height = min(r->height, d->height - r->y);
+	return true;
+}
+
+static bool devcon_video_rect_intersects(const struct devcon_video_rect *a,
+					 const struct devcon_video_rect *b)
+{
+	return a->width && a->height && b->width && b->height &&
+	       a->x < b->x + b->width && b->x < a->x + a->width &&
+	       a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static bool devcon_video_rect_covers(const struct devcon_video_rect *a,
+				     const struct devcon_video_rect *b)
+{
+	return a->x <= b->x && a->x + a->width >= b->x + b->width &&
+	       a->y <= b->y && a->y + a->height >= b->y + b->height;
+}
+
+static void devcon_display_damage(struct devcon_display *d,
+				  unsigned int x,
+				  unsigned int y,
+				  unsigned int width,
+				  unsigned int height)
+{
+	struct devcon_video_rect *r = &d->damage;
+	unsigned int x2, y2;
+
+	if (!r->width || !r->height) {
+		r->x = x;
+		r->y = y;
+		r->width = width;
+		r->height = height;
+		return;
+	}
+
+	x2 = max(r->x + r->width, x + width);
+	y2 = max(r->y + r->height, y + height);
+	r->x = min(r->x, x);
+	r->y = min(r->y, y);
+	r->width = x2 - r->x;
+	r->height = y2 - r->y;
+}
+
+static bool devcon_display_is_clipped(struct devcon_display *d,
+				      unsigned int x,
+				      unsigned int y)
+{
+	struct devcon_video_rect cell = { x, y, 1, 1 };
+	unsigned int i;
+
+	for (i = 0; i < d->n_clip; ++i)
+		if (devcon_video_rect_covers(&d->clip[i], &cell))
+			return true;
+
+	return false;
+}
+
+/*
+ * Run a single handler on a display. Opaque handlers above it are collected
+ * as clip rectangles. If one of them covers the handler entirely, the handler
+ * is skipped.
+ */
+static void devcon_display_run(struct devcon_display *d,
+			       struct devcon_video_handler *h)
+{
+	struct list_head *handlers = &devcon_video_handlers[d->seat];
+	struct devcon_video_handler *o = h;
+	struct devcon_video_rect r, c;
+
+	r = h->region;
+	if (!devcon_display_clip(d, &r))
+		return;
+
+	d->n_clip = 0;
+	list_for_each_entry_continue(o, handlers, list) {
+		c = o->region;
+		if (!o->opaque || !devcon_display_clip(d, &c))
+			continue;
+
+		if (devcon_video_rect_covers(&c, &r)) {
+			/* content is not visible, redraw once uncovered */
+			devcon_display_reset_age(d, h);
+			d->n_clip = 0;
+			return;
+		}
+
+		if (d->n_clip < DEVCON_VIDEO_CLIP_MAX &&
+		    devcon_video_rect_intersects(&c, &r))
+			d->clip[d->n_clip++] = c;
+	}
+
+	h->draw(h, d);
+	d->n_clip = 0;
+}
+
+static void devcon_display_draw(struct devcon_display *d,
+				struct devcon_video_handler *dirty_handler)
+{
+	struct devcon_video_handler *h;
+	struct list_head *handlers = &devcon_video_handlers[d->seat];
+	struct devcon_video_rect r;
+
+	/* ignore incompatible devices */
+	if (!d->font || !d->width || !d->height)
+		return;
+
+	/*
+	 * We need to run all video-handlers in the registration-order to
+	 * redraw the screen. If @dirty_handler is set, it points to the
+	 * earliest renderer that signaled that it has dirty data. Hence, we
+	 * can skip all handlers previous to it. If @dirty_handler is NULL,
+	 * it means we need to run *all* handlers. This is usually the case
 	 * on display hotplug, etc.
 	 */
+	memset(&d->damage, 0, sizeof(d->damage));
+
 	if (dirty_handler)
-		dirty_handler->draw(dirty_handler, d);
+		devcon_display_run(d, dirty_handler);
 
 	/* sets @h to beginning of the list if @dirty_handler is NULL */
-	h = list_prepare_entry(dirty_handler, &devcon_video_handlers, list);
+	h = list_prepare_entry(dirty_handler, handlers, list);
+
+	/*
+	 * If a handler painted into the region of a handler above it, the
+	 * latter might have been overdrawn, so its content age is reset to
+	 * force a full redraw.
+	 */
+	list_for_each_entry_continue(h, handlers, list) {
+		r = h->region;
+		if (devcon_display_clip(d, &r) &&
+		    devcon_video_rect_intersects(&d->damage, &r))
+			devcon_display_reset_age(d, h);
 
-	list_for_each_entry_continue(h, &devcon_video_handlers, list)
-		h->draw(h, d);
+		devcon_display_run(d, h);
+	}
 }
 
 static void devcon_video_dispatch(struct devcon_display *d,
 				  struct devcon_video_handler *dirty_handler)
 {
+	void *pseudo_palette;
+
 	/* *ALWAYS* unconditionally dequeue from scheduler-queue */
 	list_del_init(&d->schedule);
 
@@ -271,18 +1173,20 @@ static void devcon_video_dispatch(struct devcon_display *d,
 	if (d->suspended || d->blanked)
 		return;
 
+	/* ignore devices on unused seats; they're restored by the worker */
+	if (!devcon_display_is_used(d))
+		return;
+
 	if (!lock_fb_info(d->fbinfo))
 		return;
 
 	/*
 	 * If a display was hotplugged, or if it signaled a modeset, we need
-	 * to reinitialize it. We always assume the screen is dirty, so we
-	 * force a redraw.
+	 * to reinitialize it. Unless our last frame could be restored, we
+	 * assume the screen is dirty, so we force a redraw.
 	 */
-	if (d->need_mode) {
-		devcon_display_prepare(d);
+	if (!devcon_display_prepare(d))
 		d->need_redraw = true;
-	}
 
 	/*
 	 * If a display was modified (or marked for redraw for other reasons),
@@ -291,74 +1195,173 @@ static void devcon_video_dispatch(struct devcon_display *d,
 	 * forces, so all content is refreshed.
 	 */
 	if (d->need_redraw) {
+		devcon_display_invalidate(d);
 		devcon_display_recalc(d);
 		d->need_redraw = false;
 		dirty_handler = NULL;
 	}
 
+	/*
+	 * Drivers resolve the colors of fills and blits via their pseudo
+	 * palette. It is replaced by ours while drawing, so colors are looked
+	 * up in the palette of the handlers, rather than the one of fbcon.
+	 */
+	pseudo_palette = d->fbinfo->pseudo_palette;
+	d->fbinfo->pseudo_palette = d->palette;
 	devcon_display_draw(d, dirty_handler);
+	d->fbinfo->pseudo_palette = pseudo_palette;
 
 	unlock_fb_info(d->fbinfo);
 }
 
-static void devcon_video_worker(struct work_struct *work)
+static int devcon_video_add_display(struct fb_info *fbinfo)
 {
-	struct devcon_video_handler *h, *dirty_handler = NULL;
-	struct devcon_display *d;
+	int ret;
 
-	console_lock(); /* Eww.. but needed for fbdev operations */
-	mutex_lock(&devcon_video_lock);
+	ret = devcon_display_new(NULL, fbinfo);
+	if (ret < 0 && ret != -ENODEV) /* ignore hotplug races */
+		return ret;
 
-	if (list_empty(&devcon_video_handlers)) {
-		/* If there are no registered handlers, we should release all
-		 * graphics access as we have no content to display. */
-		if (devcon_video_running) {
-			list_for_each_entry(d, &devcon_displays, list)
-				devcon_display_restore(d);
-			devcon_video_running = false;
-		}
-	} else {
-		mutex_lock(&devcon_video_dirty_lock);
-		while ((h = list_first_entry_or_null(&devcon_video_dirty_list,
-						struct devcon_video_handler,
-						dirty))) {
-			list_del_init(&h->dirty);
-			if (!dirty_handler ||
-			    h->position < dirty_handler->position)
-				dirty_handler = h;
-		}
-		mutex_unlock(&devcon_video_dirty_lock);
+	return 0;
+}
 
-		if (dirty_handler)
-			list_for_each_entry(d, &devcon_displays, list)
-				devcon_video_dispatch(d, dirty_handler);
+static bool devcon_video_is_used(void)
+{
+	unsigned int i;
 
-		while ((d = list_first_entry_or_null(&devcon_schedule,
-						     struct devcon_display,
-						     schedule))) {
-			devcon_video_dispatch(d, NULL);
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		if (!list_empty(&devcon_video_handlers[i]))
+			return true;
 
-			/* safety net to avoid life-locks */
-			if (WARN_ON(!list_empty(&d->schedule)))
-				list_del_init(&d->schedule);
-		}
+	return false;
+}
+
+static void devcon_video_attach(void)
+{
+	int ret, i;
+
+	if (devcon_video_attached)
+		return;
+
+	/*
+	 * Now that we need graphics access, we bind to all existing displays.
+	 * Our fb-notifier is registered, so we get notified about any
+	 * hotplugged displays from now on. Unfortunately, this needs access to
+	 * the fbdev registration_lock, everything else is racy (as we might run
+	 * exactly in between FB_EVENT_FB_UNBIND and FB_EVENT_FB_UNREGISTER, in
+	 * which case we *MUST NOT* access the fbinfo). However, this lock is
+	 * not exposed, hence, we try to do our best and lock whatever we can
+	 * get our hands on (the caller holds the console lock).
+	 *
+	 * TODO: We *really* need to fix fbmem.c to provide an iterator,
+	 *       expose the registration lock, or add a flag that tells us a
+	 *       framebuffer is unbound.
+	 */
+	for (i = 0; i < FB_MAX; ++i) {
+		struct fb_info *fbinfo;
+
+		fbinfo = ACCESS_ONCE(registered_fb[i]);
+		if (!fbinfo)
+			continue;
+
+		ret = devcon_video_add_display(fbinfo);
+		if (ret < 0)
+			pr_err("cannot attach to framebuffer %d: %d\n",
+			       i, ret);
+	}
+
+	devcon_video_attached = true;
+	devcon_video_update_headless();
+}
+
+static void devcon_video_detach(void)
+{
+	struct devcon_display *d;
+
+	if (!devcon_video_attached)
+		return;
 
-		devcon_video_running = true;
+	while ((d = list_first_entry_or_null(&devcon_displays,
+					     struct devcon_display, list))) {
+		devcon_display_restore(d);
+		devcon_display_handback(d);
+		devcon_display_free(d);
 	}
 
+	devcon_video_attached = false;
+	devcon_video_update_headless();
+}
+
+static void devcon_video_idle_worker(struct work_struct *work)
+{
+	console_lock();
+	mutex_lock(&devcon_video_lock);
+
+	/* a handler might have been opened since the timer was armed */
+	if (!devcon_video_is_used())
+		devcon_video_detach();
+
 	mutex_unlock(&devcon_video_lock);
 	console_unlock();
 }
 
-static int devcon_video_add_display(struct fb_info *fbinfo)
+static void devcon_video_worker(struct work_struct *work)
 {
-	int ret;
+	struct devcon_video_handler *h, *t, *dirty[DEVCON_SEAT_MAX] = {};
+	struct devcon_display *d;
+	struct llist_node *node;
 
-	ret = devcon_display_new(NULL, fbinfo);
-	if (ret < 0 && ret != -ENODEV) /* ignore hotplug races */
-		return ret;
+	console_lock(); /* Eww.. but needed for fbdev operations */
+	mutex_lock(&devcon_video_lock);
 
-	return 0;
+	if (devcon_video_is_used())
+		devcon_video_attach();
+	else if (devcon_video_attached)
+		mod_delayed_work(devcon_video_wq, &devcon_video_idle_work,
+				 msecs_to_jiffies(devcon_video_idle_ms));
+
+	/*
+	 * Collect the earliest dirty handler of each seat. The dirty bit is
+	 * cleared before the handler is drawn, so any content written after
+	 * that queues it again. As this re-links the node, the next pointer
+	 * must be read before the bit is cleared.
+	 */
+	node = llist_del_all(&devcon_video_dirty_list);
+	llist_for_each_entry_safe(h, t, node, dirty) {
+		clear_bit(DEVCON_VIDEO_HANDLER_DIRTY, &h->flags);
+		if (!dirty[h->seat] || h->position < dirty[h->seat]->position)
+			dirty[h->seat] = h;
+	}
+	smp_mb__after_atomic();
+
+	list_for_each_entry(d, &devcon_displays, list) {
+		if (!devcon_display_is_used(d)) {
+			/* If there are no registered handlers on the seat of
+			 * this display, we should release graphics access as we
+			 * have no content to display. */
+			devcon_display_restore(d);
+			list_del_init(&d->schedule);
+		} else if (dirty[d->seat]) {
+			devcon_video_dispatch(d, dirty[d->seat]);
+		}
+	}
+
+	while ((d = list_first_entry_or_null(&devcon_schedule,
+					     struct devcon_display,
+					     schedule))) {
+		devcon_video_dispatch(d, NULL);
+
+		/* safety net to avoid life-locks */
+		if (WARN_ON(!list_empty(&d->schedule)))
+			list_del_init(&d->schedule);
+	}
+
+	/* hand released displays back to their previous users */
+	list_for_each_entry(d, &devcon_displays, list)
+		devcon_display_handback(d);
+
+	mutex_unlock(&devcon_video_lock);
+	console_unlock();
 }
 
 static int devcon_video_hotplug(unsigned long action,
@@ -369,6 +1372,10 @@ static int devcon_video_hotplug(unsigned long action,
 		if (WARN_ON(d))
 			return 0;
 
+		/* new displays are picked up on attach, if not attached yet */
+		if (!devcon_video_attached)
+			return 0;
+
 		return devcon_video_add_display(event->info);
 	}
 
@@ -412,6 +1419,10 @@ static int devcon_video_notify(struct notifier_block *notifier,
 	struct devcon_display *d = NULL, *di;
 	int ret;
 
+	/* sent by devcon_display_get_vc() with devcon_video_lock held */
+	if (action == FB_EVENT_GET_CONSOLE_MAP)
+		return 0;
+
 	mutex_lock(&devcon_video_lock);
 	list_for_each_entry(di, &devcon_displays, list) {
 		if (fbevent->info == di->fbinfo) {
@@ -422,6 +1433,7 @@ static int devcon_video_notify(struct notifier_block *notifier,
 	ret = devcon_video_hotplug(action, d, fbevent);
 	if (ret < 0)
 		pr_err("failed handling video event %lu: %d\n", action, ret);
+	devcon_video_update_headless();
 	mutex_unlock(&devcon_video_lock);
 
 	return 0; /* always let other handlers continue */
@@ -430,9 +1442,68 @@ static int devcon_video_notify(struct notifier_block *notifier,
 void devcon_video_init_handler(struct devcon_video_handler *handler)
 {
 	INIT_LIST_HEAD(&handler->list);
-	INIT_LIST_HEAD(&handler->dirty);
+	handler->dirty.next = NULL;
+	handler->flags = 0;
 	handler->draw = NULL;
 	handler->position = 0;
+	handler->id = 0;
+	handler->seat = 0;
+	handler->region.x = 0;
+	handler->region.y = 0;
+	handler->region.width = UINT_MAX;
+	handler->region.height = UINT_MAX;
+	handler->opaque = false;
+}
+
+/* force a redraw of all handlers on all displays of a seat */
+static void devcon_video_repaint(unsigned int seat)
+{
+	struct devcon_display *d;
+
+	list_for_each_entry(d, &devcon_displays, list) {
+		if (d->seat != seat)
+			continue;
+
+		devcon_display_reset_ages(d);
+		devcon_display_schedule(d);
+	}
+}
+
+/**
+ * devcon_video_set_region() - Set the region a handler draws to
+ * @handler:		handler to modify
+ * @x:			left border in cells
+ * @y:			top border in cells
+ * @width:		width in cells, or UINT_MAX to span the display
+ * @height:		height in cells, or UINT_MAX to span the display
+ * @opaque:		whether the handler fully paints its region
+ *
+ * This declares the region that @handler draws to. If @opaque is true, the
+ * handler promises to paint every cell of its region, so handlers below it
+ * are clipped against it, or skipped entirely if fully covered.
+ *
+ * This can be called while the handler is open, in which case all handlers
+ * of its seat are redrawn.
+ */
+void devcon_video_set_region(struct devcon_video_handler *handler,
+			     unsigned int x,
+			     unsigned int y,
+			     unsigned int width,
+			     unsigned int height,
+			     bool opaque)
+{
+	mutex_lock(&devcon_video_lock);
+
+	handler->region.x = x;
+	handler->region.y = y;
+	handler->region.width = width;
+	handler->region.height = height;
+	handler->opaque = opaque;
+
+	if (!list_empty(&handler->list))
+		devcon_video_repaint(handler->seat);
+
+	mutex_unlock(&devcon_video_lock);
 }
 
 void devcon_video_open(struct devcon_video_handler *handler)
@@ -441,21 +1512,53 @@ void devcon_video_open(struct devcon_video_handler *handler)
 		return;
 	if (WARN_ON(!list_empty(&handler->list)))
 		return;
-	if (WARN_ON(!list_empty(&handler->dirty)))
+	if (WARN_ON(test_bit(DEVCON_VIDEO_HANDLER_DIRTY, &handler->flags)))
 		return;
 	if (WARN_ON(!handler->draw))
 		return;
+	if (WARN_ON(handler->seat >= DEVCON_SEAT_MAX))
+		return;
 
 	mutex_lock(&devcon_video_lock);
 
-	list_add_tail(&handler->list, &devcon_video_handlers);
+	list_add_tail(&handler->list, &devcon_video_handlers[handler->seat]);
 	handler->position = ++devcon_video_position_counter;
+	if (!handler->id)
+		handler->id = ++devcon_video_id_counter;
 
 	mutex_unlock(&devcon_video_lock);
 }
 
+/*
+ * Remove @handler from the dirty list. A lock-less list does not support
+ * removal of single entries, so the list is taken over and all other entries
+ * are queued again. Must be called with devcon_video_lock held, so the worker
+ * cannot collect the list concurrently.
+ */
+static void devcon_video_unqueue(struct devcon_video_handler *handler)
+{
+	struct devcon_video_handler *h, *t;
+	struct llist_node *node;
+	bool queued = false;
+
+	if (!test_bit(DEVCON_VIDEO_HANDLER_DIRTY, &handler->flags))
+		return;
+
+	node = llist_del_all(&devcon_video_dirty_list);
+	llist_for_each_entry_safe(h, t, node, dirty)
+		if (h != handler)
+			queued |= llist_add(&h->dirty,
+					    &devcon_video_dirty_list);
+
+	clear_bit(DEVCON_VIDEO_HANDLER_DIRTY, &handler->flags);
+	if (queued)
+		queue_work(devcon_video_wq, &devcon_video_work);
+}
+
 void devcon_video_close(struct devcon_video_handler *handler)
 {
+	struct devcon_display *d;
+
 	if (WARN_ON(!devcon_video_notifier.notifier_call))
 		return;
 	if (WARN_ON(list_empty(&handler->list)))
@@ -463,28 +1566,237 @@ void devcon_video_close(struct devcon_video_handler *handler)
 
 	mutex_lock(&devcon_video_lock);
 
-	mutex_lock(&devcon_video_dirty_lock);
-	list_del_init(&handler->dirty);
-	mutex_unlock(&devcon_video_dirty_lock);
+	devcon_video_unqueue(handler);
+
+	/* ages are allocated lazily on the first draw of a handler */
+	list_for_each_entry(d, &devcon_displays, list)
+		devcon_display_drop_age(d, handler);
 
 	list_del_init(&handler->list);
-	if (list_empty(&devcon_video_handlers))
-		schedule_work(&devcon_video_work);
+	if (list_empty(&devcon_video_handlers[handler->seat]))
+		queue_work(devcon_video_wq, &devcon_video_work);
+	else
+		/* uncovered content must be redrawn */
+		devcon_video_repaint(handler->seat);
 
 	mutex_unlock(&devcon_video_lock);
 }
 
+/**
+ * devcon_video_dirty() - Signal new content of a handler
+ * @handler:		handler to mark dirty
+ *
+ * This marks @handler as dirty, so its draw callback is invoked by the video
+ * worker. This does not take any lock and can be called from any context. If
+ * @handler is already dirty, this is a single atomic operation. Otherwise, it
+ * is queued on the dirty list, and the worker is scheduled if the list was
+ * empty before. If the seat of @handler is headless, this is a no-op.
+ */
 void devcon_video_dirty(struct devcon_video_handler *handler)
 {
 	if (WARN_ON(!devcon_video_notifier.notifier_call))
 		return;
 
-	mutex_lock(&devcon_video_dirty_lock);
-	if (list_empty(&handler->dirty))
-		list_add_tail(&handler->dirty, &devcon_video_dirty_list);
-	if (list_is_singular(&devcon_video_dirty_list))
-		schedule_work(&devcon_video_work);
-	mutex_unlock(&devcon_video_dirty_lock);
+	if (ACCESS_ONCE(devcon_video_headless[handler->seat]))
+		return;
+
+	if (test_and_set_bit(DEVCON_VIDEO_HANDLER_DIRTY, &handler->flags))
+		return;
+
+	if (llist_add(&handler->dirty, &devcon_video_dirty_list))
+		queue_work(devcon_video_wq, &devcon_video_work);
+}
+
+static struct devcon_video_cell *devcon_display_get_cell(struct devcon_display *d,
+							 unsigned int x,
+							 unsigned int y)
+{
+	return d->cells ? &d->cells[y * d->width + x] : NULL;
+}
+
+/*
+ * Update the cell cache for a fill of @r with @color. Only the bounding box of
+ * the cells that actually change is stored in @out, false is returned if there
+ * are none.
+ */
+static bool devcon_display_fill_cells(struct devcon_display *d,
+				      const struct devcon_video_rect *r,
+				      unsigned int color,
+				      struct devcon_video_rect *out)
+{
+	const struct devcon_video_cell fill = {
+		.glyph = ' ',
+		.fg = color,
+		.bg = color,
+		.flags = DEVCON_VIDEO_CELL_VALID,
+	};
+	unsigned int x, y, x1 = UINT_MAX, y1 = UINT_MAX, x2 = 0, y2 = 0;
+	struct devcon_video_cell *cell;
+
+	for (y = r->y; y < r->y + r->height; ++y) {
+		cell = devcon_display_get_cell(d, r->x, y);
+		for (x = r->x; x < r->x + r->width; ++x, ++cell) {
+			if (!memcmp(cell, &fill, sizeof(fill)))
+				continue;
+
+			*cell = fill;
+			x1 = min(x1, x);
+			y1 = min(y1, y);
+			x2 = max(x2, x + 1);
+			y2 = max(y2, y + 1);
+		}
+	}
+
+	if (x1 >= x2)
+		return false;
+
+	/* cells within the box that were already filled are filled again */
+	*out = (struct devcon_video_rect){ x1, y1, x2 - x1, y2 - y1 };
+	return true;
+}
+
+/*
+ * Fill a rectangle with the given color, sparing the clip rectangles starting
+ * at index @clip. The parts of @r outside of the first intersecting clip
+ * rectangle are split into up to four rectangles, which are then filled
+ * recursively against the remaining clip rectangles.
+ */
+static void devcon_display_fill(struct devcon_display *d,
+				const struct devcon_video_rect *r,
+				unsigned int color,
+				unsigned int clip)
+{
+	struct fb_fillrect region = {};
+	struct devcon_video_rect p;
+	const struct devcon_video_rect *c;
+	unsigned int top, bottom;
+
+	for ( ; clip < d->n_clip; ++clip) {
+		c = &d->clip[clip];
+		if (!devcon_video_rect_intersects(c, r))
+			continue;
+
+		top = max(r->y, c->y);
+		bottom = min(r->y + r->height, c->y + c->height);
+
+		if (r->y < c->y) {
+			p = (struct devcon_video_rect){ r->x, r->y,
+							r->width, c->y - r->y };
+			devcon_display_fill(d, &p, color, clip + 1);
+		}
+		if (r->y + r->height > bottom) {
+			p = (struct devcon_video_rect){ r->x, bottom, r->width,
+							r->y + r->height - bottom };
+			devcon_display_fill(d, &p, color, clip + 1);
+		}
+		if (r->x < c->x) {
+			p = (struct devcon_video_rect){ r->x, top,
+							c->x - r->x, bottom - top };
+			devcon_display_fill(d, &p, color, clip + 1);
+		}
+		if (r->x + r->width > c->x + c->width) {
+			p = (struct devcon_video_rect){ c->x + c->width, top,
+							r->x + r->width -
+							(c->x + c->width),
+							bottom - top };
+			devcon_display_fill(d, &p, color, clip + 1);
+		}
+
+		return;
+	}
+
+	if (d->cells && !devcon_display_fill_cells(d, r, color, &p))
+		return;
+	if (!d->cells)
+		p = *r;
+
+	devcon_display_damage(d, p.x, p.y, p.width, p.height);
+
+	region.color = color;
+	region.dx = p.x * d->font->width;
+	region.dy = p.y * d->font->height;
+	region.width = p.width * d->font->width;
+	region.height = p.height * d->font->height;
+	region.rop = ROP_COPY;
+
+	d->fbinfo->fbops->fb_fillrect(d->fbinfo, &region);
+}
+
+/**
+ * devcon_video_get_age() - Get content age of a handler on a display
+ * @d:			display to query
+ * @h:			handler to query
+ *
+ * This returns a pointer to the age of the content that @h last drew on @d.
+ * It is 0 if the content is unknown (eg., after a modeset, or if a lower
+ * handler painted over it), in which case the handler must redraw everything.
+ * Handlers should store the age of their content in it after drawing, so they
+ * can skip unchanged content on the next redraw.
+ *
+ * This must only be called from within the ->draw() callback of @h. NULL is
+ * returned on allocation failure, which should be treated like an age of 0.
+ */
+u64 *devcon_video_get_age(struct devcon_display *d,
+			  struct devcon_video_handler *h)
+{
+	struct devcon_video_age *a;
+
+	list_for_each_entry(a, &d->ages, list)
+		if (a->id == h->id)
+			return &a->age;
+
+	a = kzalloc(sizeof(*a), GFP_KERNEL);
+	if (!a)
+		return NULL;
+
+	a->id = h->id;
+	list_add_tail(&a->list, &d->ages);
+	return &a->age;
+}
+
+/**
+ * devcon_video_set_palette() - Set the colors of a display
+ * @d:			display to modify
+ * @rgb:		DEVCON_VIDEO_COLORS RGB triples, in VGA color order
+ *
+ * This sets the colors the VGA color indices of all draw helpers resolve to.
+ * They are converted to native pixels once, so drawing stays a table lookup.
+ * Cached cells using a modified color are invalidated, but redrawing them is
+ * up to the caller. This must only be called from a draw callback.
+ */
+void devcon_video_set_palette(struct devcon_display *d, const u8 *rgb)
+{
+	struct devcon_video_cell *cell;
+	unsigned int i, n;
+	u32 changed = 0;
+
+	for (i = 0; i < DEVCON_VIDEO_COLORS; ++i)
+		if (!d->has_palette || memcmp(&d->rgb[i * 3], &rgb[i * 3], 3))
+			changed |= BIT(i);
+
+	if (!changed)
+		return;
+
+	memcpy(d->rgb, rgb, sizeof(d->rgb));
+	d->has_palette = true;
+	devcon_display_update_palette(d);
+
+	for (i = 0; i < ARRAY_SIZE(d->blend); ++i) {
+		if (!(changed & (BIT(i / DEVCON_VIDEO_COLORS) |
+				 BIT(i % DEVCON_VIDEO_COLORS))))
+			continue;
+
+		kfree(d->blend[i]);
+		d->blend[i] = NULL;
+	}
+
+	if (!d->cells)
+		return;
+
+	n = d->width * d->height;
+	for (i = 0, cell = d->cells; i < n; ++i, ++cell)
+		if (changed & (BIT(cell->fg) | BIT(cell->bg)))
+			cell->flags &= ~DEVCON_VIDEO_CELL_VALID;
 }
 
 void devcon_video_draw_clear(struct devcon_display *d,
@@ -493,34 +1805,178 @@ void devcon_video_draw_clear(struct devcon_display *d,
 			     unsigned int width,
 			     unsigned int height)
 {
-	struct fb_fillrect region = {};
+	devcon_video_draw_fill(d, cell_x, cell_y, width, height, 0);
+}
+
+/**
+ * devcon_video_draw_fill() - Fill a cell area with a solid color
+ * @d:			display to draw on
+ * @cell_x:		first column
+ * @cell_y:		first row
+ * @width:		number of columns
+ * @height:		number of rows
+ * @color:		VGA color index to fill with
+ *
+ * This fills the given cell area with @color, clipped against the display and
+ * against opaque handlers stacked above the current one. This is a single
+ * fillrect per visible part, so it is much cheaper than drawing blank glyphs
+ * cell by cell.
+ */
+void devcon_video_draw_fill(struct devcon_display *d,
+			    unsigned int cell_x,
+			    unsigned int cell_y,
+			    unsigned int width,
+			    unsigned int height,
+			    unsigned int color)
+{
+	struct devcon_video_rect r = { cell_x, cell_y, width, height };
 
 	if (WARN_ON(d->font->width % 8 || d->font->height % 8))
 		return;
 	if (!d->fbinfo->fbops->fb_fillrect)
 		return;
-	if (cell_x >= d->width || cell_y >= d->height)
+	if (!devcon_display_clip(d, &r))
 		return;
 
-	if (cell_x + width > d->width)
-		width = d->width - cell_x;
-	if (cell_y + height > d->height)
-		height = d->height - cell_y;
+	devcon_display_fill(d, &r, color, 0);
+}
 
-	region.color = 0;
+static void devcon_display_underline(struct devcon_display *d,
+				     unsigned int cell_x,
+				     unsigned int cell_y,
+				     unsigned int color)
+{
+	struct fb_fillrect region = {};
+	unsigned int h;
+
+	if (!d->fbinfo->fbops->fb_fillrect)
+		return;
+
+	h = max(d->font->height / 16, 1U);
+
+	region.color = color;
 	region.dx = cell_x * d->font->width;
-	region.dy = cell_y * d->font->height;
-	region.width = width * d->font->width;
-	region.height = height * d->font->height;
+	region.dy = (cell_y + 1) * d->font->height - h;
+	region.width = d->font->width;
+	region.height = h;
 	region.rop = ROP_COPY;
 
 	d->fbinfo->fbops->fb_fillrect(d->fbinfo, &region);
 }
 
-void devcon_video_draw_glyph(struct devcon_display *d,
-			     u32 ch,
-			     unsigned int cell_x,
-			     unsigned int cell_y)
+static u32 devcon_display_channel(u32 pixel, const struct fb_bitfield *f)
+{
+	return (pixel >> f->offset) & ((1U << f->length) - 1);
+}
+
+/*
+ * Get the blend table of @fg on @bg. Entry i is the pixel value of alpha i,
+ * interpolated per channel between the palette entries of both colors.
+ * Bits outside of the color channels are taken from @bg.
+ */
+static const u32 *devcon_display_get_blend(struct devcon_display *d,
+					   unsigned int fg,
+					   unsigned int bg)
+{
+	const struct fb_var_screeninfo *var = &d->fbinfo->var;
+	const struct fb_bitfield *channels[] = {
+		&var->red, &var->green, &var->blue,
+	};
+	const u32 *palette = d->palette;
+	unsigned int i, j, f, b;
+	u32 *table, v, mask;
+
+	fg %= DEVCON_VIDEO_COLORS;
+	bg %= DEVCON_VIDEO_COLORS;
+
+	table = d->blend[fg * DEVCON_VIDEO_COLORS + bg];
+	if (table)
+		return table;
+
+	table = kmalloc(sizeof(*table) * 256, GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	for (i = 0; i < 256; ++i) {
+		v = palette[bg];
+		for (j = 0; j < ARRAY_SIZE(channels); ++j) {
+			f = devcon_display_channel(palette[fg], channels[j]);
+			b = devcon_display_channel(palette[bg], channels[j]);
+			mask = ((1U << channels[j]->length) - 1) <<
+			       channels[j]->offset;
+
+			v &= ~mask;
+			v |= ((f * i + b * (255 - i) + 127) / 255) <<
+			     channels[j]->offset;
+		}
+		table[i] = v;
+	}
+
+	d->blend[fg * DEVCON_VIDEO_COLORS + bg] = table;
+	return table;
+}
+
+/* blend an atlas glyph into the bounce buffer, and copy it to the display */
+static void devcon_display_blit_alpha(struct devcon_display *d,
+				      u32 ch,
+				      unsigned int cell_x,
+				      unsigned int cell_y,
+				      unsigned int fg,
+				      unsigned int bg)
+{
+	struct fb_info *fbinfo = d->fbinfo;
+	unsigned int bpp = fbinfo->var.bits_per_pixel / 8;
+	unsigned int w = d->font->width, h = d->font->height, i, n = w * h;
+	const u8 *src = (const u8 *)d->font->data + ch * n;
+	const u32 *table;
+	char __iomem *dst;
+	u8 *p = d->glyph;
+	size_t size;
+	u32 v;
+
+	table = devcon_display_get_blend(d, fg, bg);
+	dst = devcon_display_get_visible(d, &size);
+	if (!table || !dst)
+		return;
+
+	switch (bpp) {
+	case 4:
+		for (i = 0; i < n; ++i)
+			((u32 *)p)[i] = table[src[i]];
+		break;
+	case 2:
+		for (i = 0; i < n; ++i)
+			((u16 *)p)[i] = table[src[i]];
+		break;
+	case 3:
+		for (i = 0; i < n; ++i, p += 3) {
+			v = table[src[i]];
+			p[0] = v;
+			p[1] = v >> 8;
+			p[2] = v >> 16;
+		}
+		p = d->glyph;
+		break;
+	}
+
+	/* wait for pending accelerated operations before writing directly */
+	if (fbinfo->fbops->fb_sync)
+		fbinfo->fbops->fb_sync(fbinfo);
+
+	dst += (size_t)cell_y * h * fbinfo->fix.line_length;
+	dst += cell_x * w * bpp;
+	for (i = 0; i < h; ++i)
+		memcpy_toio(dst + i * fbinfo->fix.line_length,
+			    p + i * w * bpp, w * bpp);
+}
+
+/* draw a bitmap glyph via the pixmap and ->fb_imageblit() */
+static void devcon_display_blit_bitmap(struct devcon_display *d,
+				       u32 ch,
+				       unsigned int cell_x,
+				       unsigned int cell_y,
+				       unsigned int fg,
+				       unsigned int bg)
 {
 	struct fb_image image = {};
 	u32 s_stride, s_size;
@@ -528,16 +1984,6 @@ void devcon_video_draw_glyph(struct devcon_display *d,
 	const void *s_data;
 	void *d_data;
 
-	if (WARN_ON(d->font->width % 8 || d->font->height % 8))
-		return;
-	if (!d->fbinfo->fbops->fb_imageblit)
-		return;
-	if (cell_x >= d->width || cell_y >= d->height)
-		return;
-
-	if (ch > 255)
-		ch = 0;
-
 	/* first we need to copy the glyph into the pixmap */
 
 	s_stride = d->font->width / 8;
@@ -558,8 +2004,8 @@ void devcon_video_draw_glyph(struct devcon_display *d,
 
 	/* now blend the pixmap into the framebuffer */
 
-	image.fg_color = 7;
-	image.bg_color = 0;
+	image.fg_color = fg;
+	image.bg_color = bg;
 	image.dx = cell_x * d->font->width;
 	image.dy = cell_y * d->font->height;
 	image.width = d->font->width;
@@ -570,72 +2016,269 @@ void devcon_video_draw_glyph(struct devcon_display *d,
 	d->fbinfo->fbops->fb_imageblit(d->fbinfo, &image);
 }
 
-int devcon_video_init(void)
+/**
+ * devcon_video_draw_glyph() - Draw a single cell
+ * @d:			display to draw on
+ * @ch:			character to draw
+ * @cell_x:		column
+ * @cell_y:		row
+ * @fg:			VGA color index of the foreground
+ * @bg:			VGA color index of the background
+ * @underline:		whether to underline the cell in @fg
+ *
+ * This draws a single cell, unless it is clipped, or the cell cache of @d says
+ * the exact same content is visible already.
+ */
+void devcon_video_draw_glyph(struct devcon_display *d,
+			     u32 ch,
+			     unsigned int cell_x,
+			     unsigned int cell_y,
+			     unsigned int fg,
+			     unsigned int bg,
+			     bool underline)
 {
-	int ret, i;
+	struct devcon_video_cell *cell, new = {};
 
-	if (WARN_ON(devcon_video_notifier.notifier_call))
-		return -EINVAL;
+	if (WARN_ON(d->font->width % 8 || d->font->height % 8))
+		return;
+	if (!d->alpha && !d->fbinfo->fbops->fb_imageblit)
+		return;
+	if (cell_x >= d->width || cell_y >= d->height)
+		return;
+	if (devcon_display_is_clipped(d, cell_x, cell_y))
+		return;
 
-	devcon_video_notifier.notifier_call = devcon_video_notify;
-	ret = fb_register_client(&devcon_video_notifier);
-	if (ret < 0)
-		goto error;
+	if (ch > 255)
+		ch = 0;
+
+	new.glyph = ch;
+	new.fg = fg;
+	new.bg = bg;
+	new.flags = DEVCON_VIDEO_CELL_VALID;
+	if (underline)
+		new.flags |= DEVCON_VIDEO_CELL_UNDERLINE;
+
+	cell = devcon_display_get_cell(d, cell_x, cell_y);
+	if (cell) {
+		if (!memcmp(cell, &new, sizeof(new)))
+			return;
+		*cell = new;
+	}
+
+	devcon_display_damage(d, cell_x, cell_y, 1, 1);
+
+	if (d->alpha)
+		devcon_display_blit_alpha(d, ch, cell_x, cell_y, fg, bg);
+	else
+		devcon_display_blit_bitmap(d, ch, cell_x, cell_y, fg, bg);
+
+	if (underline)
+		devcon_display_underline(d, cell_x, cell_y, fg);
+}
+
+static int devcon_video_set_seat(int node, unsigned int seat)
+{
+	struct devcon_display *d;
+
+	if (node < 0 || node >= FB_MAX || seat >= DEVCON_SEAT_MAX)
+		return -EINVAL;
 
-	/*
-	 * Now that our fb-notifier is registered, we need to bind to all
-	 * existing displays. Unfortunately, this needs access to the fbdev
-	 * registration_lock, everything else is racy (as we might run exactly
-	 * in between FB_EVENT_FB_UNBIND and FB_EVENT_FB_UNREGISTER, in which
-	 * case we *MUST NOT* access the fbinfo). However, this lock is not
-	 * exposed, hence, we try to do our best and lock whatever we can get
-	 * our hands on.
-	 *
-	 * TODO: We *really* need to fix fbmem.c to provide an iterator,
-	 *       expose the registration lock, or add a flag that tells us a
-	 *       framebuffer is unbound.
-	 */
 	console_lock();
 	mutex_lock(&devcon_video_lock);
-	for (i = 0; i < FB_MAX; ++i) {
-		struct fb_info *fbinfo;
 
-		fbinfo = ACCESS_ONCE(registered_fb[i]);
-		if (!fbinfo)
+	/* remembered for displays that are not attached, yet */
+	devcon_video_fb_seats[node] = seat;
+
+	list_for_each_entry(d, &devcon_displays, list) {
+		if (d->fbinfo->node != node)
 			continue;
 
-		ret = devcon_video_add_display(fbinfo);
-		if (ret < 0)
-			pr_err("cannot attach to framebuffer %d: %d\n",
-			       i, ret);
+		/*
+		 * Release the display from its old seat, and let the new seat
+		 * take it over (if it has any handlers). If the seat is
+		 * unchanged, this simply forces a full modeset and redraw.
+		 */
+		devcon_display_restore(d);
+		devcon_display_handback(d);
+		d->seat = seat;
+		d->need_redraw = true;
+		devcon_display_schedule(d);
+		break;
 	}
+
+	devcon_video_update_headless();
 	mutex_unlock(&devcon_video_lock);
 	console_unlock();
 
 	return 0;
+}
+
+static int devcon_video_debugfs_show(struct seq_file *m, void *v)
+{
+	struct devcon_display *d;
+
+	mutex_lock(&devcon_video_lock);
+	list_for_each_entry(d, &devcon_displays, list)
+		seq_printf(m, "fb%d %u %ux%u\n",
+			   d->fbinfo->node, d->seat, d->width, d->height);
+	mutex_unlock(&devcon_video_lock);
+
+	return 0;
+}
+
+static int devcon_video_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, devcon_video_debugfs_show, NULL);
+}
+
+/*
+ * Writing "fb<node> <seat>" to the debugfs file moves the given framebuffer
+ * to the given seat.
+ */
+static ssize_t devcon_video_debugfs_write(struct file *file,
+					  const char __user *ubuf,
+					  size_t size,
+					  loff_t *off)
+{
+	unsigned int seat;
+	char buf[64];
+	int ret, node;
+
+	if (size >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, size))
+		return -EFAULT;
+
+	buf[size] = 0;
+	if (sscanf(buf, "fb%d %u", &node, &seat) != 2)
+		return -EINVAL;
+
+	ret = devcon_video_set_seat(node, seat);
+	if (ret < 0)
+		return ret;
+
+	return size;
+}
+
+static const struct file_operations devcon_video_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= devcon_video_debugfs_open,
+	.read		= seq_read,
+	.write		= devcon_video_debugfs_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Load the glyph atlas named by the "font" parameter. Its dimensions must be
+ * 8-aligned, like those of bitmap fonts. On failure, all displays fall back
+ * to bitmap fonts.
+ */
+static int devcon_video_load_atlas(void)
+{
+	const struct devcon_atlas_header *hdr;
+	const struct firmware *fw;
+	unsigned int w, h;
+	int ret;
+
+	if (!devcon_video_font || !*devcon_video_font)
+		return 0;
+
+	ret = request_firmware_direct(&fw, devcon_video_font, NULL);
+	if (ret < 0)
+		return ret;
+
+	hdr = (const void *)fw->data;
+	if (fw->size < sizeof(*hdr) ||
+	    le32_to_cpu(hdr->magic) != DEVCON_ATLAS_MAGIC)
+		goto invalid;
+
+	w = le16_to_cpu(hdr->width);
+	h = le16_to_cpu(hdr->height);
+	if (!w || !h || w % 8 || h % 8 ||
+	    fw->size - sizeof(*hdr) < (size_t)w * h * DEVCON_ATLAS_GLYPHS)
+		goto invalid;
+
+	devcon_video_atlas.width = w;
+	devcon_video_atlas.height = h;
+	devcon_video_atlas.data = hdr + 1;
+	devcon_video_atlas_fw = fw;
+	return 0;
+
+invalid:
+	release_firmware(fw);
+	return -EINVAL;
+}
+
+int devcon_video_init(struct dentry *debugfs)
+{
+	int ret, i;
+
+	if (WARN_ON(devcon_video_notifier.notifier_call))
+		return -EINVAL;
+
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		INIT_LIST_HEAD(&devcon_video_handlers[i]);
+
+	ret = devcon_video_load_atlas();
+	if (ret < 0)
+		pr_warn("cannot load glyph atlas %s: %d\n",
+			devcon_video_font, ret);
+
+	/*
+	 * Rendering is latency critical (it delays echo), so it runs on a
+	 * dedicated high-priority queue. The queue is unbound, and its cpumask
+	 * can be changed via sysfs to keep rendering off isolated CPUs.
+	 */
+	devcon_video_wq = alloc_workqueue("devcon_video",
+					  WQ_HIGHPRI | WQ_UNBOUND | WQ_SYSFS, 0);
+	if (!devcon_video_wq)
+		return -ENOMEM;
+
+	devcon_video_notifier.notifier_call = devcon_video_notify;
+	ret = fb_register_client(&devcon_video_notifier);
+	if (ret < 0)
+		goto error;
+
+	if (debugfs)
+		debugfs_create_file("displays", S_IRUSR | S_IWUSR, debugfs,
+				    NULL, &devcon_video_debugfs_fops);
+
+	return 0;
 
 error:
 	memset(&devcon_video_notifier, 0, sizeof(devcon_video_notifier));
+	destroy_workqueue(devcon_video_wq);
+	devcon_video_wq = NULL;
 	return ret;
 }
 
 void devcon_video_destroy(void)
 {
-	struct devcon_display *d;
+	int i;
 
 	if (!devcon_video_notifier.notifier_call)
 		return;
 
-	WARN_ON(!list_empty(&devcon_video_handlers));
+	for (i = 0; i < DEVCON_SEAT_MAX; ++i)
+		WARN_ON(!list_empty(&devcon_video_handlers[i]));
 
 	fb_unregister_client(&devcon_video_notifier);
 	cancel_work_sync(&devcon_video_work);
+	cancel_delayed_work_sync(&devcon_video_idle_work);
 	memset(&devcon_video_notifier, 0, sizeof(devcon_video_notifier));
 
-	/* locking optional, as we run exclusively */
+	/* the console lock is needed to give displays back to fbcon */
+	console_lock();
 	mutex_lock(&devcon_video_lock);
-	while ((d = list_first_entry_or_null(&devcon_displays,
-					     struct devcon_display, list)))
-		devcon_display_free(d);
+	devcon_video_detach();
 	mutex_unlock(&devcon_video_lock);
+	console_unlock();
+
+	destroy_workqueue(devcon_video_wq);
+	devcon_video_wq = NULL;
+
+	release_firmware(devcon_video_atlas_fw);
+	devcon_video_atlas_fw = NULL;
+	devcon_video_atlas.data = NULL;
 }
@@ -12,34 +12,70 @@
 
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include "seat.h"
 
+struct dentry;
 struct devcon_display;
 struct devcon_video_handler;
 
+/* the 16 VGA colors, followed by the default foreground and background */
+#define DEVCON_VIDEO_COLORS 18
+
+struct devcon_video_rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
 struct devcon_video_handler {
 	struct list_head list;
-	struct list_head dirty;
+	struct llist_node dirty;
+	unsigned long flags;
 	void (*draw) (struct devcon_video_handler *,
 		      struct devcon_display *);
 	u64 position;
+	u64 id;
+	unsigned int seat;
+	struct devcon_video_rect region;
+	bool opaque : 1;
 };
 
-int devcon_video_init(void);
+int devcon_video_init(struct dentry *debugfs);
 void devcon_video_destroy(void);
 
 void devcon_video_init_handler(struct devcon_video_handler *handler);
 void devcon_video_open(struct devcon_video_handler *handler);
 void devcon_video_close(struct devcon_video_handler *handler);
 void devcon_video_dirty(struct devcon_video_handler *handler);
+void devcon_video_set_region(struct devcon_video_handler *handler,
+			     unsigned int x,
+			     unsigned int y,
+			     unsigned int width,
+			     unsigned int height,
+			     bool opaque);
+u64 *devcon_video_get_age(struct devcon_display *d,
+			  struct devcon_video_handler *h);
 
+void devcon_video_set_palette(struct devcon_display *d, const u8 *rgb);
 void devcon_video_draw_clear(struct devcon_display *d,
 			     unsigned int cell_x,
 			     unsigned int cell_y,
 			     unsigned int width,
 			     unsigned int height);
+void devcon_video_draw_fill(struct devcon_display *d,
+			    unsigned int cell_x,
+			    unsigned int cell_y,
+			    unsigned int width,
+			    unsigned int height,
+			    unsigned int color);
 void devcon_video_draw_glyph(struct devcon_display *d,
 			     u32 ch,
 			     unsigned int cell_x,
-			     unsigned int cell_y);
+			     unsigned int cell_y,
+			     unsigned int fg,
+			     unsigned int bg,
+			     bool underline);
 
 #endif /* __DEVCON_VIDEO_H */
@@ -62,6 +62,7 @@
  * Latest version: http://www.cl.cam.ac.uk/~mgk25/ucs/wcwidth.c
  */
 
+#include <linux/init.h>
 #include "page.h"
 
 struct interval {
@@ -205,3 +206,64 @@ int mk_wcwidth(int ucs)
       (ucs >= 0x20000 && ucs <= 0x2fffd) ||
       (ucs >= 0x30000 && ucs <= 0x3fffd)));
 }
+
+/*
+ * Width cache for the basic multilingual plane
+ * mk_wcwidth() bisects the combining table for every character that is not a
+ * control character, which is the common case on the hot path of the screen.
+ * The widths of the BMP are cached as 2-bit values, encoded such that a zeroed
+ * table yields width 1. Until devcon_wcwidth_init() ran, lookups thus behave
+ * like the screen did before it knew about character widths.
+ */
+
+static const s8 devcon_wcwidth_decode[4] = { 1, 2, 0, -1 };
+static u8 devcon_wcwidth_bmp[0x10000 / 4] __read_mostly;
+
+/**
+ * devcon_wcwidth_init() - Fill the width cache
+ *
+ * This must be called once during module initialization, before any screen is
+ * fed with data.
+ */
+void __init devcon_wcwidth_init(void)
+{
+	unsigned int ucs, v;
+
+	for (ucs = 0; ucs < 0x10000; ++ucs) {
+		switch (mk_wcwidth(ucs)) {
+		case 2:
+			v = 1;
+			break;
+		case 0:
+			v = 2;
+			break;
+		case -1:
+			v = 3;
+			break;
+		default:
+			v = 0;
+			break;
+		}
+
+		devcon_wcwidth_bmp[ucs / 4] |= v << (ucs % 4 * 2);
+	}
+}
+
+/**
+ * devcon_wcwidth() - Return the cell-width of a codepoint
+ * @ucs4: UCS-4 codepoint
+ *
+ * This is a cached version of mk_wcwidth(). Characters outside the BMP are
+ * rare enough to be looked up directly.
+ *
+ * Returns: -1 for control characters, 0 for combining characters, 1 or 2 for
+ *          everything else.
+ */
+int devcon_wcwidth(u32 ucs4)
+{
+	if (ucs4 >= 0x10000)
+		return mk_wcwidth(ucs4);
+
+	return devcon_wcwidth_decode[(devcon_wcwidth_bmp[ucs4 / 4] >>
+				      (ucs4 % 4 * 2)) & 0x3];
+}